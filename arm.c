@@ -51,6 +51,12 @@ static void oi_at(long pos, long n, int l)
 	mem_cpy(&cs, pos, ointbuf(n, l), l);
 }
 
+static long oi_get(long pos)
+{
+	unsigned char *s = (unsigned char *) mem_buf(&cs) + pos;
+	return s[0] | (s[1] << 8) | (s[2] << 16) | ((unsigned long) s[3] << 24);
+}
+
 static long opos(void)
 {
 	return mem_len(&cs);
@@ -87,7 +93,17 @@ static long *lab_loc;		/* label offsets in cs */
 static long jmp_n, jmp_sz;	/* jump count */
 static long *jmp_off;		/* jump offsets */
 static long *jmp_dst;		/* jump destinations */
-static long jmp_ret;		/* the position of the last return jmp */
+static long jmp_ret = -1;	/* the position of the last return jmp */
+static long lab_last;		/* the last label of the current function */
+
+static long *tc_sym;		/* tail call symbols */
+static long *tc_off;		/* tail call symbol offsets */
+static long *tc_jmp;		/* tail call jumps in jmp_off[] */
+static long tc_n, tc_sz;	/* tail call count */
+
+static long gd_op;		/* the jump of the entry guard (i_guard()) */
+static long gd_r1, gd_r2;	/* the operands of the entry guard */
+static long gd_rop, gd_ret;	/* the value returned by the entry guard */
 
 static void lab_add(long id)
 {
@@ -114,6 +130,7 @@ static void jmp_add(long off, long dst)
 void i_label(long id)
 {
 	lab_add(id + 1);
+	lab_last = id + 1;
 }
 
 static void rel_add(long sym, long flg, long off)
@@ -146,6 +163,21 @@ static void i_div(char *func)
 static long *num_off;			/* data immediate value */
 static long *num_sym;	/* relocation data symbol name */
 static int num_n, num_sz;
+static long *pld_off;		/* pool loads in cs */
+static long *pld_idx;		/* pool entries loaded by pld_off[] */
+static int pld_n, pld_sz;
+static int pld_far;		/* pool entries beyond a single ldr */
+
+/*
+ * The pool of the previous function; functions are placed one after
+ * the other, so a pool is shared with the functions after it if they
+ * need no new entries.
+ */
+static long *ppool_off;
+static long *ppool_sym;
+static int ppool_n, ppool_sz;
+static long ppool_dist;		/* the distance of its end to the pool */
+static long *pool_map;		/* pool entries in the shared pool */
 
 static int pool_find(long sym, long off)
 {
@@ -246,6 +278,24 @@ static void i_add_imm(int op, int rd, int rn, long n)
 
 static void i_ldr(int l, int rd, int rn, int off, int bt);
 
+/* load the pool entry at offset off */
+static void i_ldpool(int rd, int off)
+{
+	if (off < 0x1000) {
+		if (pld_n == pld_sz) {
+			pld_sz = MAX(128, pld_sz * 2);
+			pld_off = mextend(pld_off, pld_n, pld_sz, sizeof(*pld_off));
+			pld_idx = mextend(pld_idx, pld_n, pld_sz, sizeof(*pld_idx));
+		}
+		pld_off[pld_n] = opos();
+		pld_idx[pld_n] = off >> 2;
+		pld_n++;
+	} else {
+		pld_far = 1;
+	}
+	i_ldr(1, rd, REG_DP, off, LONGSZ);
+}
+
 static void i_num(int rd, long n)
 {
 	int enc = add_encimm(n);
@@ -258,7 +308,7 @@ static void i_num(int rd, long n)
 		oi4(ADD(I_MVN, rd, 0, 0, 1, 14) | enc);
 		return;
 	}
-	i_ldr(1, rd, REG_DP, pool_num(n), LONGSZ);
+	i_ldpool(rd, pool_num(n));
 }
 
 static void i_add_anyimm(int rd, int rn, long n)
@@ -294,6 +344,18 @@ static void i_mul(int rd, int rn, int rm)
 	oi4(MUL(rd, rn, rm));
 }
 
+/* the high half of the product: smull or umull */
+static void i_mulh(long op, int rd, int rn, int rm)
+{
+	int sign = O_T(op) & T_MSIGN ? 1 : 0;
+	if (rd == rm) {		/* rdhi and rm should differ */
+		rm = rn;
+		rn = rd;
+	}
+	oi4(0xe0800090 | (sign << 22) | (rd << 16) | (REG_TMP << 12) |
+		(rn << 8) | rm);
+}
+
 static int opcode_set(long op)
 {
 	/* lt, ge, eq, ne, le, gt */
@@ -412,10 +474,21 @@ static void i_ldr(int l, int rd, int rn, int off, int bt)
 			((off & 0xf0) << 4) | (off & 0x0f));
 }
 
+/* load or store with the address rn + (rm << sh) */
+static void i_ldrx(int l, int rd, int rn, int rm, int sh, int bt)
+{
+	int b = T_SZ(bt) == 1;
+	int h = T_SZ(bt) == 2;
+	int s = l && (bt & T_MSIGN);
+	if (!h && !(b && s))
+		oi4(LDR(l, rd, rn, b, 1, 1, 0) | (1 << 25) | (sh << 7) | rm);
+	else
+		oi4(LDRH(l, rd, rn, s, h, 1, 0) | rm);
+}
+
 static void i_sym(int rd, long sym, long off)
 {
-	int doff = pool_reloc(sym, off);
-	i_ldr(1, rd, REG_DP, doff, LONGSZ);
+	i_ldpool(rd, pool_reloc(sym, off));
 }
 
 static void i_neg(int rd, int r1)
@@ -487,8 +560,26 @@ static long i_jmp(long op, long rn, long rm)
 	return -1;
 }
 
+/* copy or fill words while rn >= 4; rd and rs should be word aligned */
+static void i_memword(int l, int rd, int rs, int rn)
+{
+	oi4(ADD(I_SUB, rn, rn, 1, 1, 14) | 4);
+	oi4(BL(4, 0, l ? 16 : 12));
+	if (l)
+		oi4(LDR(1, REG_TMP, rs, 0, 1, 0, 0) | 4);
+	oi4(LDR(0, l ? REG_TMP : rs, rd, 0, 1, 0, 0) | 4);
+	oi4(BL(14, 0, l ? -16 : -12));
+	oi4(ADD(I_ADD, rn, rn, 0, 1, 14) | 4);
+}
+
 static void i_memcpy(int rd, int rs, int rn)
 {
+	/* the word loop, if both addresses are aligned */
+	oi4(ADD(I_ORR, REG_TMP, rd, 0, 0, 14) | rs);
+	oi4(ADD(I_TST, 0, REG_TMP, 1, 1, 14) | 3);
+	oi4(BL(1, 0, 28));
+	i_memword(1, rd, rs, rn);
+	/* the remaining bytes */
 	oi4(ADD(I_SUB, rn, rn, 1, 1, 14) | 1);
 	oi4(BL(4, 0, 16));
 	oi4(LDR(1, REG_TMP, rs, 1, 1, 0, 0) | 1);
@@ -498,6 +589,15 @@ static void i_memcpy(int rd, int rs, int rn)
 
 static void i_memset(int rd, int rs, int rn)
 {
+	/* replicating the byte in rs */
+	oi4(ADD(I_AND, rs, rs, 0, 1, 14) | 0xff);
+	oi4(ADD(I_ORR, rs, rs, 0, 0, 14) | (8 << 7) | rs);
+	oi4(ADD(I_ORR, rs, rs, 0, 0, 14) | (16 << 7) | rs);
+	/* the word loop, if the address is aligned */
+	oi4(ADD(I_TST, 0, rd, 1, 1, 14) | 3);
+	oi4(BL(1, 0, 24));
+	i_memword(0, rd, rs, rn);
+	/* the remaining bytes */
 	oi4(ADD(I_SUB, rn, rn, 1, 1, 14) | 1);
 	oi4(BL(4, 0, 12));
 	oi4(LDR(0, rs, rd, 1, 1, 0, 0) | 1);
@@ -516,6 +616,22 @@ static void i_call(long sym, long off)
 	oi4(BL(14, 1, off));
 }
 
+/* jump to the exit of a tail call, generated in i_wrap() */
+static void i_tailcall(long sym, long off)
+{
+	if (tc_n == tc_sz) {
+		tc_sz = MAX(16, tc_sz * 2);
+		tc_sym = mextend(tc_sym, tc_n, tc_sz, sizeof(*tc_sym));
+		tc_off = mextend(tc_off, tc_n, tc_sz, sizeof(*tc_off));
+		tc_jmp = mextend(tc_jmp, tc_n, tc_sz, sizeof(*tc_jmp));
+	}
+	tc_sym[tc_n] = sym;
+	tc_off[tc_n] = off;
+	tc_jmp[tc_n] = jmp_n;
+	tc_n++;
+	jmp_add(i_jmp(O_JMP, 0, 0), 0);
+}
+
 int i_imm(long lim, long n)
 {
 	return add_decimm(add_encimm(n)) == n;
@@ -524,11 +640,15 @@ int i_imm(long lim, long n)
 long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 {
 	long oc = O_C(op);
+	long bt = O_T(op);
 	*rd = 0;
 	*r1 = 0;
 	*r2 = 0;
 	*r3 = 0;
 	*tmp = 0;
+	/* no memory operands */
+	if (oc & O_IND)
+		return 1;
 	if (oc & O_MOV) {
 		*rd = R_TMPS;
 		*r1 = oc & (O_NUM | O_SYM) ? 32 : R_TMPS;
@@ -558,7 +678,7 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 		*r1 = 1 << 4;
 		*r2 = 1 << 5;
 		*r3 = 1 << 6;
-		*tmp = (1 << 4) | (1 << 6) | (oc == O_MCPY ? (1 << 5) : 0);
+		*tmp = (1 << 4) | (1 << 5) | (1 << 6);
 		return 0;
 	}
 	if (oc == O_RET) {
@@ -569,19 +689,21 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 		*rd = (1 << REG_RET);
 		*r1 = oc & O_SYM ? 0 : R_TMPS;
 		*tmp = R_TMPS & ~R_PERM;
-		return 0;
+		return oc & O_RET && !(oc & O_SYM);
 	}
 	if (oc & O_LD) {
 		*rd = R_TMPS;
 		*r1 = R_TMPS;
 		*r2 = oc & O_NUM ? 0 : R_TMPS;
-		return 0;
+		/* halfword and signed byte loads take no shifted index */
+		return (oc & 0x0f) && (T_SZ(bt) == 2 ||
+			(T_SZ(bt) == 1 && bt & T_MSIGN));
 	}
 	if (oc & O_ST) {
 		*r1 = R_TMPS;
 		*r2 = R_TMPS;
 		*r3 = oc & O_NUM ? 0 : R_TMPS;
-		return 0;
+		return (oc & 0x0f) && T_SZ(bt) == 2;
 	}
 	if (oc & O_JZ) {
 		*r1 = R_TMPS;
@@ -624,6 +746,8 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 			i_div(O_T(op) & T_MSIGN ? "__divdi3" : "__udivdi3");
 		if (oc == O_MOD)
 			i_div(O_T(op) & T_MSIGN ? "__moddi3" : "__umoddi3");
+		if (oc == O_MULH)
+			i_mulh(op, rd, r1, r2);
 		return 0;
 	}
 	if (oc & O_CMP) {
@@ -643,6 +767,11 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 			i_lnot(rd, r1);
 		return 0;
 	}
+	if (oc == (O_CALL | O_SYM | O_RET)) {
+		func_call = 1;
+		i_tailcall(r1, r2);
+		return 0;
+	}
 	if (oc == O_CALL) {
 		func_call = 1;
 		i_call_reg(r1);
@@ -682,6 +811,14 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 		i_ldr(0, r1, r2, r3, bt);
 		return 0;
 	}
+	if ((oc & ~0x0f) == O_LD) {
+		i_ldrx(1, rd, r1, r2, oc & 0x0f, bt);
+		return 0;
+	}
+	if ((oc & ~0x0f) == O_ST) {
+		i_ldrx(0, r1, r2, r3, oc & 0x0f, bt);
+		return 0;
+	}
 	if (oc == O_MOV) {
 		if (T_SZ(bt) == LONGSZ)
 			i_mov(rd, r1);
@@ -700,12 +837,216 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 	return 1;
 }
 
-void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs_pos)
+/* return the offset of the shared pool from pc for entries mapped into it */
+static long pool_share(long pc)
+{
+	long dist, npos;
+	int i, j;
+	if (pld_far || ppool_n == 0)
+		return -1;
+	pool_map = malloc(num_n * sizeof(pool_map[0]));
+	for (i = 0; i < num_n; i++) {
+		for (j = 0; j < ppool_n; j++)
+			if (ppool_sym[j] == num_sym[i] && ppool_off[j] == num_off[i])
+				break;
+		if (j == ppool_n)
+			break;
+		pool_map[i] = j;
+	}
+	dist = pc + ppool_dist;
+	npos = add_decimm(add_rndimm(add_encimm(dist)));
+	if (i < num_n || npos < dist || (ppool_n << 2) + npos - dist >= 0x1000) {
+		free(pool_map);
+		pool_map = NULL;
+		return -1;
+	}
+	for (i = 0; i < num_n; i++)
+		pool_map[i] = (pool_map[i] << 2) + npos - dist;
+	return npos;
+}
+
+/* adjust pool loads for the shared pool; the body is moved by diff */
+static void pool_patch(long diff)
+{
+	int i;
+	for (i = 0; i < pld_n; i++) {
+		long pos = pld_off[i] + diff;
+		oi_at(pos, (oi_get(pos) & ~0xfff) | pool_map[pld_idx[i]], 4);
+	}
+	free(pool_map);
+	pool_map = NULL;
+}
+
+/* remember the pool of the current function of length len */
+static void pool_save(int own, long len)
+{
+	int i;
+	if (!own) {
+		ppool_dist += len;
+		return;
+	}
+	if (num_n > ppool_sz) {
+		ppool_sz = MAX(128, num_n);
+		ppool_off = mextend(ppool_off, ppool_n, ppool_sz, sizeof(*ppool_off));
+		ppool_sym = mextend(ppool_sym, ppool_n, ppool_sz, sizeof(*ppool_sym));
+	}
+	for (i = 0; i < num_n; i++) {
+		ppool_off[i] = num_off[i];
+		ppool_sym[i] = num_sym[i];
+	}
+	ppool_n = num_n;
+	ppool_dist = num_n << 2;
+}
+
+#define IFCVT_MAX	4	/* the longest predicated if-else bodies */
+
+/* return nonzero if instructions at beg till end can be predicated */
+static int ifcvt_ok(long beg, long end)
+{
+	long pos;
+	for (pos = beg; pos < end; pos += 4) {
+		long c = oi_get(pos);
+		int cls = (c >> 25) & 7;
+		if ((c >> 28) != 14 || cls > 3 || ((c >> 12) & 0x0f) == REG_PC)
+			return 0;
+		/* flag setting instructions, except halfword loads */
+		if (cls < 2 && c & (1 << 20) &&
+				((c & 0x0e000090) != 0x90 || !(c & 0x60)))
+			return 0;
+	}
+	return 1;
+}
+
+/* return nonzero if a jump other than j1 and j2 lands in beg till end */
+static int ifcvt_dst(long beg, long end, long j1, long j2)
+{
+	long i;
+	for (i = 0; i < jmp_n; i++)
+		if (i != j1 && i != j2 && jmp_dst[i] &&
+				lab_loc[jmp_dst[i]] >= beg && lab_loc[jmp_dst[i]] < end)
+			return 1;
+	return 0;
+}
+
+static void ifcvt_cond(long beg, long end, long cond)
+{
+	long pos;
+	for (pos = beg; pos < end; pos += 4)
+		oi_at(pos, (oi_get(pos) & 0x0fffffff) | (cond << 28), 4);
+}
+
+/* remove the j-th jump from the code */
+static void jmp_del(long j)
+{
+	long pos = jmp_off[j];
+	char *s = mem_buf(&cs);
+	long i;
+	memmove(s + pos, s + pos + 4, opos() - pos - 4);
+	mem_cut(&cs, opos() - 4);
+	for (i = 0; i < lab_sz; i++)
+		if (lab_loc[i] > pos)
+			lab_loc[i] -= 4;
+	for (i = 0; i < rel_n; i++)
+		if (rel_off[i] > pos)
+			rel_off[i] -= 4;
+	for (i = 0; i < tc_n; i++)
+		if (tc_jmp[i] > j)
+			tc_jmp[i]--;
+	for (i = 0; i < pld_n; i++)
+		if (pld_off[i] > pos)
+			pld_off[i] -= 4;
+	if (jmp_ret == pos)
+		jmp_ret = -1;
+	if (jmp_ret > pos)
+		jmp_ret -= 4;
+	for (i = j; i + 1 < jmp_n; i++) {
+		jmp_off[i] = jmp_off[i + 1] - 4;
+		jmp_dst[i] = jmp_dst[i + 1];
+	}
+	jmp_n--;
+}
+
+/* replace branches around short if and if-else bodies with predication */
+static void i_ifcvt(void)
+{
+	long i = 0, j;
+	while (i < jmp_n) {
+		long p = jmp_off[i];
+		long cond = oi_get(p) >> 28;
+		long q = jmp_dst[i] ? lab_loc[jmp_dst[i]] : -1;
+		long r = -1;
+		if (cond == 14 || q <= p + 4 || q > p + 4 + IFCVT_MAX * 4) {
+			i++;
+			continue;
+		}
+		/* an if-else: the if body ends with a jump over the else body */
+		for (j = i + 1; j < jmp_n && jmp_off[j] < q - 4; j++)
+			;
+		if (j < jmp_n && jmp_off[j] == q - 4 && jmp_dst[j] &&
+				oi_get(q - 4) >> 28 == 14) {
+			r = lab_loc[jmp_dst[j]];
+			if (r <= q || r - p - 8 > IFCVT_MAX * 4 ||
+					!ifcvt_ok(p + 4, q - 4) || !ifcvt_ok(q, r) ||
+					ifcvt_dst(p + 4, r, i, j))
+				r = -1;
+		}
+		if (r >= 0) {
+			ifcvt_cond(p + 4, q - 4, cond ^ 1);
+			ifcvt_cond(q, r, cond);
+			jmp_del(j);
+			jmp_del(i);
+			continue;
+		}
+		if (ifcvt_ok(p + 4, q) && !ifcvt_dst(p + 4, q, i, i)) {
+			ifcvt_cond(p + 4, q, cond ^ 1);
+			jmp_del(i);
+			continue;
+		}
+		i++;
+	}
+}
+
+long i_guard(long op, long r1, long r2, long rop, long ret)
+{
+	if (rop & O_NUM && !i_imm(0, ret) && !i_imm(0, ~ret))
+		return 1;
+	gd_op = op;
+	gd_r1 = r1;
+	gd_r2 = r2;
+	gd_rop = rop;
+	gd_ret = ret;
+	return 0;
+}
+
+/* return before the prologue with predicated instructions, if the entry guard holds */
+static void i_guardret(void)
+{
+	int cond = opcode_set(gd_op);
+	if (gd_op & O_JZ) {
+		i_tst(gd_r1, gd_r1);
+		cond = O_C(gd_op) == O_JZ ? 0 : 1;
+	} else if (gd_op & O_NUM) {
+		i_cmp_imm(gd_r1, gd_r2);
+	} else {
+		i_cmp(gd_r1, gd_r2);
+	}
+	if (gd_rop & O_NUM && i_imm(0, gd_ret))
+		oi4(ADD(I_MOV, REG_RET, 0, 0, 1, cond) | add_encimm(gd_ret));
+	else if (gd_rop & O_NUM)
+		oi4(ADD(I_MVN, REG_RET, 0, 0, 1, cond) | add_encimm(~gd_ret));
+	else if (gd_ret != REG_RET)
+		oi4(ADD(I_MOV, REG_RET, 0, 0, 0, cond) | gd_ret);
+	oi4(0x01a0f00e | (cond << 28));		/* movcc pc, lr */
+	gd_op = 0;
+}
+
+void i_wrap(int argc, int aregs, long sargs, long spsub, int initfp, long sregs, long sregs_pos)
 {
 	long body_n;
 	void *body;
 	long diff;		/* prologue length */
 	long dpadd;
+	long dpsub = -1;	/* data pointer offset for a shared pool */
 	int nsargs = 0;		/* number of saved arguments */
 	int initdp = num_n > 0;	/* initialize data pointer */
 	long pregs = 1;		/* registers saved in function prologue */
@@ -715,6 +1056,8 @@ void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs
 	if (!initfp && !spsub && !initdp && !sargs && argc < N_ARGS)
 		pregs = 0;
 	initfp = initfp || pregs;
+	if (opt(1))
+		i_ifcvt();
 	/* removing the last jmp to the epilogue */
 	if (jmp_ret + 4 == opos()) {
 		mem_cut(&cs, jmp_ret);
@@ -724,6 +1067,8 @@ void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs
 	body_n = mem_len(&cs);
 	body = mem_get(&cs);
 	/* generating function prologue */
+	if (gd_op)
+		i_guardret();
 	for (i = 0; i < N_ARGS; i++)
 		if ((1 << argregs[i]) & sargs)
 			nsargs++;
@@ -732,6 +1077,7 @@ void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs
 			if (!((1 << argregs[i]) & sargs))
 				break;
 		sargs |= 1 << argregs[i];
+		nsargs++;
 	}
 	if (sargs)
 		oi4(0xe92d0000 | sargs);	/* stmfd sp!, {r0-r3} */
@@ -753,7 +1099,11 @@ void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs
 	}
 	if (initdp) {
 		dpadd = opos();
-		oi4(0xe28fa000);		/* add   dp, pc, xx */
+		dpsub = pool_share(dpadd + 8);
+		if (dpsub >= 0)			/* sub   dp, pc, xx */
+			oi4(0xe24fa000 | add_encimm(dpsub));
+		else				/* add   dp, pc, xx */
+			oi4(0xe28fa000);
 	}
 	if (sregs) {				/* saving registers */
 		oi4(0xe24bc000 | add_encimm(-sregs_pos));
@@ -762,6 +1112,8 @@ void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs
 	diff = mem_len(&cs);
 	mem_put(&cs, body, body_n);
 	free(body);
+	if (dpsub >= 0)
+		pool_patch(diff);
 	/* generating function epilogue */
 	if (sregs) {				/* restoring saved registers */
 		oi4(0xe24bc000 | add_encimm(-sregs_pos));
@@ -779,15 +1131,31 @@ void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs
 		jmp_off[i] += diff;
 	for (i = 0; i < lab_sz; i++)
 		lab_loc[i] += diff;
+	/* tail call exits: releasing the frame and jumping to the callee */
+	for (i = 0; i < tc_n; i++) {
+		jmp_dst[tc_jmp[i]] = lab_last + 1 + i;
+		lab_add(lab_last + 1 + i);
+		if (sregs) {
+			oi4(0xe24bc000 | add_encimm(-sregs_pos));
+			oi4(0xe89c0000 | sregs);	/* ldmfd ip, {r4-r9} */
+		}
+		oi4(0xe89b5c00);		/* ldmfd fp, {sl, fp, ip, lr} */
+		oi4(0xe28cd000 | (nsargs << 2));	/* add sp, ip, xx */
+		rel_add(tc_sym[i], OUT_CS | OUT_RLREL | OUT_RL24, opos());
+		oi4(BL(14, 0, tc_off[i]));
+	}
+	tc_n = 0;
+	jmp_ret = -1;
 	/* writing the data pool */
-	if (initdp) {
+	if (initdp && dpsub < 0) {
 		int dpoff = opos() - dpadd - 8;
 		dpoff = add_decimm(add_rndimm(add_encimm(dpoff)));
 		mem_putz(&cs, dpadd + dpoff + 8 - opos());
 		/* fill data ptr addition: dp = pc + xx */
 		oi_at(dpadd, 0xe28fa000 | add_encimm(dpoff), 4);
+		pool_write();
 	}
-	pool_write();
+	pool_save(initdp && dpsub < 0, opos());
 }
 
 static void i_fill(long src, long dst)
@@ -815,6 +1183,8 @@ void i_code(char **c, long *c_len, long **rsym, long **rflg, long **roff, long *
 	rel_sz = 0;
 	jmp_n = 0;
 	num_n = 0;
+	pld_n = 0;
+	pld_far = 0;
 	func_call = 0;
 }
 
@@ -831,4 +1201,11 @@ void i_done(void)
 	free(lab_loc);
 	free(num_sym);
 	free(num_off);
+	free(pld_off);
+	free(pld_idx);
+	free(ppool_sym);
+	free(ppool_off);
+	free(tc_sym);
+	free(tc_off);
+	free(tc_jmp);
 }
@@ -16,3 +16,7 @@
 /* stack positions */
 #define I_ARG0		(-16)	/* offset of the first argument from FP */
 #define I_LOC0		0	/* offset of the first local from FP */
+#define I_REGENT	0	/* all functions take arguments in registers */
+
+#define I_MEMMAX	16	/* the longest unrolled block copy or fill */
+#define I_MEMWORD	1	/* the widest access in unrolled blocks */
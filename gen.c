@@ -13,9 +13,21 @@ static long ic_i;		/* current instruction */
 static long *ic_luse;		/* last instruction in which values are used */
 
 static long *loc_off;		/* offset of locals on the stack */
+static long *loc_len;		/* size of locals (zero for arguments) */
 static long loc_n, loc_sz;	/* number of locals */
 static long loc_pos;		/* current stack position */
 static int *loc_mem;		/* local was accessed on the stack */
+static long *loc_beg;		/* the first instruction in which a local is live */
+static long *loc_end;		/* the instruction after its live span */
+static long *loc_bhead;		/* locals whose live span starts at each instruction */
+static long *loc_bnext;		/* next entries in loc_bhead[] lists */
+
+static long *slot_off;		/* the offset of each stack slot */
+static long *slot_len;		/* the size of each stack slot */
+static long *slot_next;		/* next entries in slot_ehead[] and slot_free lists */
+static long *slot_ehead;	/* slots released at each instruction */
+static long slot_free;		/* the list of released slots */
+static long slot_n;		/* number of stack slots */
 
 static char (*ds_name)[NAMELEN];/* data section symbols */
 static long *ds_off;		/* data section offsets */
@@ -23,30 +35,40 @@ static long ds_n, ds_sz;	/* number of data section symbols */
 
 static int func_argc;		/* number of arguments */
 static int func_varg;		/* varargs */
+static int func_aregs;		/* argument registers at function entry */
+static long func_sym;		/* function symbol, if it may be inlined */
 static int func_regs;		/* used registers */
 static int func_maxargs;	/* the maximum number of arguments on the stack */
 static long *ic_bbeg;		/* whether each instruction begins a basic block */
+static long func_id;		/* function symbol */
+static long func_guard;		/* the entry jump tested before the prologue */
+static long *fn_keep;		/* caller-saved registers each function preserves */
+static int *fn_aregs;		/* arguments each function takes in registers */
+static long fn_sz;		/* size of fn_keep[] */
 
 static long ra_vmap[N_REGS];	/* register to intermediate value assignments */
 static long ra_lmap[N_REGS];	/* register to local assignments */
 static long *ra_gmask;		/* the mask of good registers for each value */
 static long ra_live[NTMPS];	/* live values */
+static long *ra_voff;		/* the stack slot of values stored on the stack */
 static int ra_vmax;		/* the number of values stored on the stack */
 
-static long loc_add(long pos)
+static long loc_add(long pos, long len)
 {
 	if (loc_n >= loc_sz) {
 		loc_sz = MAX(128, loc_sz * 2);
 		loc_off = mextend(loc_off, loc_n, loc_sz, sizeof(loc_off[0]));
+		loc_len = mextend(loc_len, loc_n, loc_sz, sizeof(loc_len[0]));
 	}
 	loc_off[loc_n] = pos;
+	loc_len[loc_n] = len;
 	return loc_n++;
 }
 
+/* the stack position of locals is decided in loc_layout() */
 long o_mklocal(long sz)
 {
-	loc_pos += ALIGN(sz, ULNG);
-	return loc_add(loc_pos);
+	return loc_add(0, ALIGN(MAX(sz, 1), ULNG));
 }
 
 void o_rmlocal(long addr, long sz)
@@ -187,6 +209,30 @@ static long ra_regcheap(long mask)
 			~ra_lmask() & ~ra_vmask());
 }
 
+/*
+ * The number of arguments call c passes in registers.  With I_REGENT,
+ * only direct calls to functions defined earlier pass arguments in
+ * registers; they call the entry after the loads of these arguments.
+ */
+static int ic_aregs(struct ic *c)
+{
+	if (!I_REGENT)
+		return MIN(N_ARGS, c->a3);
+	if (c->op & O_SYM && !c->a2 && c->a1 < fn_sz &&
+			c->a3 >= fn_aregs[c->a1])
+		return fn_aregs[c->a1];
+	return 0;
+}
+
+/* the registers instruction c modifies; mt is reported by i_reg() */
+static long ic_tmask(struct ic *c, long mt)
+{
+	/* calls to functions defined earlier clobber only their registers */
+	if (opt(1) && O_C(c->op) == (O_CALL | O_SYM) && !c->a2 && c->a1 < fn_sz)
+		return mt & ~fn_keep[c->a1];
+	return mt;
+}
+
 /* allocate registers for the current instruction */
 static void ra_map(int *rd, int *r1, int *r2, int *r3, long *mt)
 {
@@ -210,7 +256,7 @@ static void ra_map(int *rd, int *r1, int *r2, int *r3, long *mt)
 	}
 	/* do not use argument registers to hold call destination */
 	if (oc & O_CALL)
-		for (i = 0; i < MIN(c->a3, N_ARGS); i++)
+		for (i = 0; i < ic_aregs(c); i++)
 			all |= (1 << argregs[i]);
 
 	/* instructions on locals can be simplified */
@@ -222,14 +268,19 @@ static void ra_map(int *rd, int *r1, int *r2, int *r3, long *mt)
 	}
 	if (i_reg(c->op, &md, &m1, &m2, &m3, mt))
 		die("neatcc: instruction %08lx not supported\n", c->op);
+	*mt = ic_tmask(c, *mt);
 
 	/*
 	 * the registers used in global register allocation should not
-	 * be used in the last instruction of a basic block.
+	 * be used in the last instruction of a basic block, unless they
+	 * already hold both the local and the operand; ra_bbend() would
+	 * reload the local over it.
 	 */
 	if (c->op & (O_JZ | O_JCC))
 		for (i = 0; i < LEN(ra_lmap); i++)
-			if (reg_rmap(ic_i, i) >= 0 && ra_lmap[i] != reg_rmap(ic_i, i))
+			if (reg_rmap(ic_i, i) >= 0 && (ra_lmap[i] != reg_rmap(ic_i, i) ||
+					(ra_vmap[i] != c->a1 &&
+					(n < 2 || ra_vmap[i] != c->a2))))
 				all |= (1 << i);
 	/* allocating registers for the operands */
 	if (n >= 2) {
@@ -268,19 +319,39 @@ static void ra_map(int *rd, int *r1, int *r2, int *r3, long *mt)
 	func_regs |= all | *mt;
 }
 
-static long iv_rank(long iv)
+/* a stack slot for len bytes, released at instruction end */
+static long loc_slot(long len, long end)
 {
-	int i;
-	for (i = 0; i < LEN(ra_live); i++)
-		if (ra_live[i] == iv)
-			return i;
-	die("neatcc: the specified value is not live\n");
-	return 0;
+	long *p = &slot_free;
+	long n;
+	while (*p >= 0 && slot_len[*p] != len)
+		p = &slot_next[*p];
+	if (*p >= 0) {
+		n = *p;
+		*p = slot_next[n];
+	} else {
+		n = slot_n++;
+		slot_off[n] = loc_pos;
+		slot_len[n] = len;
+		loc_pos += len;
+	}
+	end = MAX(end, ic_i + 1);
+	slot_next[n] = slot_ehead[end];
+	slot_ehead[end] = n;
+	return slot_off[n] + len;
 }
 
-static long iv_addr(long rank)
+/* release the slots of instruction i and place the locals live from it */
+static void loc_place(long i)
 {
-	return loc_pos + rank * ULNG + ULNG;
+	long n;
+	while ((n = slot_ehead[i]) >= 0) {
+		slot_ehead[i] = slot_next[n];
+		slot_next[n] = slot_free;
+		slot_free = n;
+	}
+	for (n = loc_bhead[i]; n >= 0; n = loc_bnext[n])
+		loc_off[n] = loc_slot(loc_len[n], loc_end[n]);
 }
 
 static void loc_toreg(long loc, long off, int reg, int bt)
@@ -311,16 +382,42 @@ static int loc_isread(long loc)
 	return 0;
 }
 
+/* return nonzero if the value can be recomputed instead of being stored */
+static int val_isremat(long val)
+{
+	long n, sym, off;
+	if (O_C(ic[val].op) == (O_MOV | O_LOC))
+		return 1;
+	return !ic_num(ic, val, &n) || !ic_sym(ic, val, &sym, &off);
+}
+
+/* recompute a constant or an address in register reg */
+static void val_remat(long val, int reg)
+{
+	long n, sym, off;
+	if (O_C(ic[val].op) == (O_MOV | O_LOC))
+		loc_toadd(ic[val].a1, ic[val].a2, reg);
+	else if (!ic_num(ic, val, &n))
+		i_ins(O_MOV | O_NUM, reg, n, 0, 0);
+	else if (!ic_sym(ic, val, &sym, &off))
+		i_ins(O_MOV | O_SYM, reg, sym, off, 0);
+}
+
 static void val_toreg(long val, int reg)
 {
-	i_ins(O_MK(O_LD | O_NUM, ULNG), reg, REG_FP, -iv_addr(iv_rank(val)), 0);
+	if (val_isremat(val))
+		val_remat(val, reg);
+	else
+		i_ins(O_MK(O_LD | O_NUM, ULNG), reg, REG_FP, -ra_voff[val], 0);
 }
 
 static void val_tomem(long val, int reg)
 {
-	long rank = iv_rank(val);
-	ra_vmax = MAX(ra_vmax, rank + 1);
-	i_ins(O_MK(O_ST | O_NUM, ULNG), 0, reg, REG_FP, -iv_addr(rank));
+	if (!ra_voff[val]) {
+		ra_voff[val] = loc_slot(ULNG, ic_luse[val] + 1);
+		ra_vmax++;
+	}
+	i_ins(O_MK(O_ST | O_NUM, ULNG), 0, reg, REG_FP, -ra_voff[val]);
 }
 
 /* move the value to the stack */
@@ -328,7 +425,8 @@ static void ra_spill(int reg)
 {
 	//printf("spill: %d\n", reg); fflush(stdout);
 	if (ra_vmap[reg] >= 0) {
-		val_tomem(ra_vmap[reg], reg);
+		if (!val_isremat(ra_vmap[reg]))
+			val_tomem(ra_vmap[reg], reg);
 		ra_vmap[reg] = -1;
 	}
 	if (ra_lmap[reg] >= 0) {
@@ -386,7 +484,8 @@ static void ra_vmove(long iv, long mask)
 	if (dst >= 0 && ra_vmap[dst] < 0 && ra_lmap[dst] < 0) {
 		i_ins(O_MK(O_MOV, ULNG), dst, src, 0, 0);
 		ra_vmap[dst] = iv;
-	} else {
+		func_regs |= 1 << dst;
+	} else if (!val_isremat(iv)) {
 		val_tomem(iv, src);
 	}
 	ra_vmap[src] = -1;
@@ -466,13 +565,74 @@ static void ra_bbend(void)
 	}
 }
 
+/* mark the instructions reachable after taking the address of a local */
+static char *ic_escape(struct ic *ic, long ic_n)
+{
+	char *esc = calloc(ic_n + 1, sizeof(esc[0]));
+	long *stk = malloc((ic_n + 1) * sizeof(stk[0]));
+	long stk_n = 0;
+	long i;
+	for (i = 0; i < ic_n; i++) {
+		if (O_C(ic[i].op) == (O_MOV | O_LOC)) {
+			esc[i] = 1;
+			stk[stk_n++] = i;
+		}
+	}
+	while (stk_n > 0) {
+		long op = ic[(i = stk[--stk_n])].op;
+		if (!(op & (O_JMP | O_RET)) && i + 1 < ic_n && !esc[i + 1]) {
+			esc[i + 1] = 1;
+			stk[stk_n++] = i + 1;
+		}
+		if (op & O_JXX && ic[i].a3 < ic_n && !esc[ic[i].a3]) {
+			esc[ic[i].a3] = 1;
+			stk[stk_n++] = ic[i].a3;
+		}
+	}
+	free(stk);
+	return esc;
+}
+
+/*
+ * Return nonzero if the call at instruction i, whose result is returned
+ * immediately, can jump to the callee after releasing the stack frame.
+ * The callee may not access the locals of this function (no address of
+ * a local is taken on the paths to the call; esc[] is computed by
+ * ic_escape()) and its stack arguments should fit in the area of the
+ * incoming arguments.
+ */
+static int ra_tailcall(long i, char *esc)
+{
+	long md, m1, m2, m3, mt;
+	long argc = ic[i].a3;
+	long aregs = ic_aregs(&ic[i]);
+	if (!opt(1) || func_varg || i + 1 >= ic_n || esc[i])
+		return 0;
+	if (ic[i + 1].op != O_RET || ic[i + 1].a1 != i)
+		return 0;
+	if (argc > aregs && (aregs || argc > func_argc))
+		return 0;
+	/* callees may save register arguments in their stack slots */
+	if (I_REGENT && argc > func_argc)
+		return 0;
+	return !i_reg(ic[i].op | O_RET, &md, &m1, &m2, &m3, &mt);
+}
+
 static void ra_init(struct ic *ic, long ic_n)
 {
 	long md, m1, m2, m3, mt;
-	int i, j;
+	char *esc;
+	long i, j;
 	ic_bbeg = calloc(ic_n, sizeof(ic_bbeg[0]));
 	ra_gmask = calloc(ic_n, sizeof(ra_gmask[0]));
+	ra_voff = calloc(ic_n, sizeof(ra_voff[0]));
 	loc_mem = calloc(loc_n, sizeof(loc_mem[0]));
+	/* marking tail calls */
+	esc = ic_escape(ic, ic_n);
+	for (i = 0; i < ic_n; i++)
+		if (ic[i].op & O_CALL && ra_tailcall(i, esc))
+			ic[i].op |= O_RET;
+	free(esc);
 	/* ic_bbeg */
 	for (i = 0; i < ic_n; i++) {
 		if (i + 1 < ic_n && ic[i].op & (O_JXX | O_RET))
@@ -494,7 +654,7 @@ static void ra_init(struct ic *ic, long ic_n)
 		if (O_C(op) == (O_ST | O_LOC) && reg_lmap(i, ic[i].a2))
 			ra_gmask[ic[i].a1] = 1 << reg_lmap(i, ic[i].a2);
 		if (op & O_CALL)
-			for (j = 0; j < MIN(N_ARGS, ic[i].a3); j++)
+			for (j = 0; j < ic_aregs(&ic[i]); j++)
 				ra_gmask[ic[i].args[j]] = 1 << argregs[j];
 	}
 	/* ra_vmap */
@@ -515,7 +675,334 @@ static void ra_done(void)
 {
 	free(ic_bbeg);
 	free(ra_gmask);
+	free(ra_voff);
 	free(loc_mem);
+	free(loc_beg);
+	free(loc_end);
+	free(loc_bhead);
+	free(loc_bnext);
+	free(slot_off);
+	free(slot_len);
+	free(slot_next);
+	free(slot_ehead);
+}
+
+/* return the local accessed by instruction c or -1 */
+static long ic_local(struct ic *c)
+{
+	long oc = O_C(c->op);
+	if (oc == (O_LD | O_LOC) || oc == (O_MOV | O_LOC))
+		return c->a1;
+	if (oc == (O_ST | O_LOC))
+		return c->a2;
+	return -1;
+}
+
+/*
+ * Find the live spans of locals.  The live span of each local covers
+ * its accesses and the regions in which it is allocated a register,
+ * extended to include the loops it intersects.  Locals whose address
+ * is taken live until the end of the function.  Stack slots are
+ * assigned in loc_place(), in the order of the start of live spans,
+ * and locals with disjoint live spans share them.
+ */
+static void loc_layout(struct ic *ic, long ic_n)
+{
+	long *lend = calloc(ic_n, sizeof(lend[0]));
+	long *lhead = malloc(ic_n * sizeof(lhead[0]));
+	long i, h = -1;
+	loc_beg = malloc(loc_n * sizeof(loc_beg[0]));
+	loc_end = malloc(loc_n * sizeof(loc_end[0]));
+	loc_bhead = malloc((ic_n + 1) * sizeof(loc_bhead[0]));
+	loc_bnext = malloc(loc_n * sizeof(loc_bnext[0]));
+	slot_off = malloc((loc_n + ic_n) * sizeof(slot_off[0]));
+	slot_len = malloc((loc_n + ic_n) * sizeof(slot_len[0]));
+	slot_next = malloc((loc_n + ic_n) * sizeof(slot_next[0]));
+	slot_ehead = malloc((ic_n + 1) * sizeof(slot_ehead[0]));
+	slot_free = -1;
+	slot_n = 0;
+	for (i = 0; i < loc_n; i++) {
+		loc_beg[i] = ic_n;
+		loc_end[i] = 0;
+	}
+	for (i = 0; i <= ic_n; i++) {
+		loc_bhead[i] = -1;
+		slot_ehead[i] = -1;
+	}
+	for (i = 0; i < ic_n; i++) {
+		long loc = ic_local(&ic[i]);
+		if (loc < 0)
+			continue;
+		loc_beg[loc] = MIN(loc_beg[loc], i);
+		loc_end[loc] = MAX(loc_end[loc], i + 1);
+	}
+	reg_span(loc_beg, loc_end);
+	for (i = 0; i < ic_n; i++)
+		if (O_C(ic[i].op) == (O_MOV | O_LOC))
+			loc_end[ic[i].a1] = ic_n;
+	/* merging overlapping loops; lhead[] is the loop containing each instruction */
+	for (i = 0; i < ic_n; i++)
+		if (ic[i].op & O_JXX && ic[i].a3 <= i)
+			lend[ic[i].a3] = MAX(lend[ic[i].a3], i + 1);
+	for (i = 0; i < ic_n; i++) {
+		if (h >= 0 && i >= lend[h])
+			h = -1;
+		if (lend[i] > i) {
+			if (h < 0)
+				h = i;
+			lend[h] = MAX(lend[h], lend[i]);
+		}
+		lhead[i] = h;
+	}
+	for (i = loc_n - 1; i >= func_argc; i--) {
+		if (loc_beg[i] >= loc_end[i])
+			continue;
+		if (lhead[loc_beg[i]] >= 0)
+			loc_beg[i] = lhead[loc_beg[i]];
+		if (lhead[loc_end[i] - 1] >= 0)
+			loc_end[i] = lend[lhead[loc_end[i] - 1]];
+		loc_bnext[i] = loc_bhead[loc_beg[i]];
+		loc_bhead[loc_beg[i]] = i;
+	}
+	free(lend);
+	free(lhead);
+}
+
+/* the number of times the value of each instruction is used */
+static long *ic_usecnt(struct ic *ic, long ic_n)
+{
+	long *ucnt = calloc(ic_n, sizeof(ucnt[0]));
+	long i, j;
+	for (i = 0; i < ic_n; i++) {
+		int n = ic_regcnt(ic + i);
+		if (n >= 1)
+			ucnt[ic[i].a1]++;
+		if (n >= 2)
+			ucnt[ic[i].a2]++;
+		if (n >= 3)
+			ucnt[ic[i].a3]++;
+		if (ic[i].op & O_CALL)
+			for (j = 0; j < ic[i].a3; j++)
+				ucnt[ic[i].args[j]]++;
+	}
+	return ucnt;
+}
+
+/* the number of basic blocks beginning in (0, i] for each instruction */
+static long *ic_bbnum(struct ic *ic, long ic_n)
+{
+	long *bbnum = calloc(ic_n + 1, sizeof(bbnum[0]));
+	long i;
+	for (i = 0; i < ic_n; i++) {
+		if (ic[i].op & (O_JXX | O_RET))
+			bbnum[i + 1] = 1;
+		if (ic[i].op & O_JXX)
+			bbnum[ic[i].a3] = 1;
+	}
+	for (i = 1; i <= ic_n; i++)
+		bbnum[i] += bbnum[i - 1];
+	return bbnum;
+}
+
+/* return nonzero if a basic block begins in (beg, end] */
+static int ic_bbcut(long *bbnum, long beg, long end)
+{
+	return bbnum[beg] != bbnum[end];
+}
+
+/*
+ * Return nonzero if the local loaded by instruction iv is accessed
+ * before instruction end; keeping the loaded value in the local's
+ * register until end would force moving it elsewhere.
+ */
+static int ic_lbusy(struct ic *ic, long iv, long end)
+{
+	long i;
+	if (O_C(ic[iv].op) != (O_LD | O_LOC))
+		return 0;
+	for (i = iv + 1; i < end; i++)
+		if (ic_local(&ic[i]) == ic[iv].a1)
+			return 1;
+	return 0;
+}
+
+/*
+ * Fold the address computations of the form base + (idx << s) into
+ * the loads and stores that use them, if the architecture supports
+ * the addressing mode; i_reg() fails for unsupported scales.  The
+ * folded additions and shifts are left unused and not generated.
+ */
+static void ic_amode(struct ic *ic, long ic_n)
+{
+	long md, m1, m2, m3, mt;
+	long *ucnt = ic_usecnt(ic, ic_n);
+	long *bbnum = ic_bbnum(ic, ic_n);
+	long i;
+	for (i = 0; i < ic_n; i++) {
+		long oc = O_C(ic[i].op);
+		long bt = O_T(ic[i].op);
+		long addr, base, idx, s = 0;
+		if (oc == (O_LD | O_NUM) && !ic[i].a2)
+			addr = ic[i].a1;
+		else if (oc == (O_ST | O_NUM) && !ic[i].a3)
+			addr = ic[i].a2;
+		else
+			continue;
+		if (O_C(ic[addr].op) != O_ADD || ucnt[addr] != 1 ||
+				ic_bbcut(bbnum, addr, i))
+			continue;
+		base = ic[addr].a1;
+		idx = ic[addr].a2;
+		if (O_C(ic[base].op) == (O_SHL | O_NUM)) {
+			base = ic[addr].a2;
+			idx = ic[addr].a1;
+		}
+		if (O_C(ic[idx].op) == (O_SHL | O_NUM) && ic[idx].a2 <= 3 &&
+				ucnt[idx] == 1 &&
+				!i_reg(O_MK((oc & ~O_NUM) | ic[idx].a2, bt),
+					&md, &m1, &m2, &m3, &mt)) {
+			s = ic[idx].a2;
+			idx = ic[idx].a1;
+		}
+		if (i_reg(O_MK((oc & ~O_NUM) | s, bt), &md, &m1, &m2, &m3, &mt))
+			continue;
+		if (ic_lbusy(ic, base, i) || ic_lbusy(ic, idx, i))
+			continue;
+		ucnt[addr]--;
+		if (s)
+			ucnt[ic[addr].a1 == base ? ic[addr].a2 : ic[addr].a1]--;
+		ic[i].op = O_MK((oc & ~O_NUM) | s, bt);
+		if (oc & O_LD) {
+			ic[i].a1 = base;
+			ic[i].a2 = idx;
+		} else {
+			ic[i].a2 = base;
+			ic[i].a3 = idx;
+		}
+	}
+	free(bbnum);
+	free(ucnt);
+}
+
+/* return nonzero if the load at ld can be performed at instruction end */
+static int ic_ldmove(struct ic *ic, long *ucnt, long *bbnum, long ld, long end)
+{
+	long i;
+	if (O_C(ic[ld].op) != (O_LD | O_NUM) || ucnt[ld] != 1)
+		return 0;
+	if (T_SZ(O_T(ic[ld].op)) != ULNG || ic_bbcut(bbnum, ld, end))
+		return 0;
+	for (i = ld + 1; i < end; i++)
+		if (ic[i].op & (O_ST | O_MEM | O_CALL))
+			return 0;
+	return !ic_lbusy(ic, ic[ld].a1, end);
+}
+
+/*
+ * Let binary operations read their second operand directly from
+ * memory (O_IND), if it is loaded only for them and the architecture
+ * supports it.  The folded loads are left unused and not generated.
+ */
+static void ic_memop(struct ic *ic, long ic_n)
+{
+	long md, m1, m2, m3, mt;
+	long *ucnt = ic_usecnt(ic, ic_n);
+	long *bbnum = ic_bbnum(ic, ic_n);
+	long i;
+	for (i = 0; i < ic_n; i++) {
+		long op = ic[i].op;
+		long oc = O_C(op);
+		long ld;
+		if (!(oc & (O_ADD | O_CMP)) || oc & (O_NUM | O_IND))
+			continue;
+		if (i_reg(op | O_IND, &md, &m1, &m2, &m3, &mt))
+			continue;
+		ld = ic[i].a2;
+		if (!ic_ldmove(ic, ucnt, bbnum, ld, i))
+			continue;
+		ucnt[ld]--;
+		ic[i].op = op | O_IND;
+		ic[i].a2 = ic[ld].a1;
+		ic[i].a3 = ic[ld].a2;
+	}
+	free(bbnum);
+	free(ucnt);
+}
+
+/* the argument whose register instruction i loads or -1 */
+static long ic_argld(struct ic *ic, long i)
+{
+	if (O_C(ic[i].op) != (O_LD | O_LOC) || ic[i].a2)
+		return -1;
+	if (T_SZ(O_T(ic[i].op)) != ULNG)
+		return -1;
+	return ic[i].a1 < MIN(func_argc, func_aregs) ? ic[i].a1 : -1;
+}
+
+/*
+ * Shrink-wrapping of early exits: if the first jump of the function
+ * tests an argument and skips a return of a constant or an argument,
+ * ask the backend to perform the test and the return before the
+ * prologue.  The jump and the return are then omitted from the body.
+ */
+static long ic_guard(struct ic *ic, long ic_n)
+{
+	long j = 0, i;
+	long arg, rarg, rop, ret;
+	if (!opt(1) || func_varg)
+		return -1;
+	while (j < ic_n && !(ic[j].op & (O_JXX | O_RET | O_CALL | O_MEM)))
+		j++;
+	if (j + 3 >= ic_n || !(ic[j].op & (O_JZ | O_JCC)) || ic[j].a3 != j + 3)
+		return -1;
+	if (ic[j].op & O_JCC && !(ic[j].op & O_NUM))
+		return -1;
+	if ((arg = ic_argld(ic, ic[j].a1)) < 0)
+		return -1;
+	/* the return skipped by the jump */
+	rop = O_MOV | O_NUM;
+	ret = ic[j + 1].a1;
+	rarg = ic_argld(ic, j + 1);
+	if (O_C(ic[j + 1].op) != (O_MOV | O_NUM)) {
+		if (rarg < 0)
+			return -1;
+		rop = O_MOV;
+		ret = argregs[rarg];
+	}
+	if (O_C(ic[j + 2].op) != O_RET || ic[j + 2].a1 != j + 1)
+		return -1;
+	/* instructions before the jump may only change other locals */
+	for (i = 0; i < j; i++)
+		if (ic[i].op & O_ST && (O_C(ic[i].op) != (O_ST | O_LOC) ||
+				ic[i].a2 == arg || ic[i].a2 == rarg))
+			return -1;
+	/* the guard is not executed again */
+	for (i = 0; i < ic_n; i++)
+		if (ic[i].op & O_JXX && ic[i].a3 <= j + 2)
+			return -1;
+	if (i_guard(ic[j].op ^ 1, argregs[arg], ic[j].a2, rop, ret))
+		return -1;
+	return j;
+}
+
+/* caller-saved registers that no instruction modifies */
+static long ic_keep(struct ic *ic, long ic_n)
+{
+	long md, m1, m2, m3, mt;
+	long keep = R_TMPS & ~R_PERM;
+	long i;
+	int j;
+	for (i = 0; i < ic_n; i++) {
+		if (i_reg(ic[i].op, &md, &m1, &m2, &m3, &mt))
+			return 0;
+		keep &= ~ic_tmask(ic + i, mt);
+		if (ic[i].op & O_CALL) {
+			keep &= ~md;
+			for (j = 0; j < ic_aregs(&ic[i]); j++)
+				keep &= ~(1 << argregs[j]);
+		}
+	}
+	return keep;
 }
 
 static void ic_gencode(struct ic *ic, long ic_n)
@@ -527,7 +1014,7 @@ static void ic_gencode(struct ic *ic, long ic_n)
 	for (i = 0; i < LEN(ra_lmap); i++) {
 		int loc = ra_lmap[i];
 		if (loc >= 0 && loc < func_argc)
-			if (loc >= N_ARGS || i != argregs[loc])
+			if (loc >= func_aregs || i != argregs[loc])
 				loc_toreg(loc, 0, i, ULNG);
 	}
 	/* generating code */
@@ -536,21 +1023,40 @@ static void ic_gencode(struct ic *ic, long ic_n)
 		long oc = O_C(op);
 		int n = ic_regcnt(ic + i);
 		ic_i = i;
+		loc_place(i);
 		i_label(i);
+		/* folded address computations */
+		if (oc & O_OUT && !(oc & O_CALL) && !ic_luse[i]) {
+			if (i + 1 < ic_n && ic_bbeg[i + 1])
+				ra_bbend();
+			continue;
+		}
+		/* the entry guard is tested before the prologue */
+		if (func_guard >= 0 && i >= func_guard && i <= func_guard + 2) {
+			if (i == func_guard)
+				ra_bbend();
+			continue;
+		}
+		/* the return after tail calls is unreachable */
+		if (oc == O_RET && i > 0 && ic[i - 1].op & O_CALL &&
+				ic[i - 1].op & O_RET)
+			continue;
 		ra_map(&rd, &r1, &r2, &r3, &mt);
 		if (oc & O_CALL) {
 			int argc = ic[i].a3;
-			int aregs = MIN(N_ARGS, argc);
+			int aregs = ic_aregs(&ic[i]);
+			/* with I_REGENT, register arguments have stack slots */
+			int aslot = I_REGENT ? 0 : aregs;
 			/* arguments passed via stack */
 			for (j = argc - 1; j >= aregs; --j) {
 				int v = ic[i].args[j];
 				int rx = ra_vreg(v) >= 0 ? ra_vreg(v) : rd;
 				ra_vload(v, rx);
 				i_ins(O_MK(O_ST | O_NUM, ULNG), 0,
-					rx, REG_SP, (j - aregs) * ULNG);
+					rx, REG_SP, (j - aslot) * ULNG);
 				ra_vdrop(v);
 			}
-			func_maxargs = MAX(func_maxargs, argc - aregs);
+			func_maxargs = MAX(func_maxargs, argc - aslot);
 			/* arguments passed via registers */
 			for (j = aregs - 1; j >= 0; --j)
 				ra_vload(ic[i].args[j], argregs[j]);
@@ -580,15 +1086,20 @@ static void ic_gencode(struct ic *ic, long ic_n)
 			ra_bbend();
 		/* performing the instruction */
 		if (oc & O_BOP)
-			i_ins(op, rd, r1, oc & O_NUM ? ic[i].a2 : r2, 0);
+			i_ins(op, rd, r1, oc & O_NUM ? ic[i].a2 : r2,
+				oc & O_IND ? ic[i].a3 : 0);
 		if (oc & O_UOP)
 			i_ins(op, rd, r1, r2, 0);
 		if (oc == (O_LD | O_NUM))
 			i_ins(op, rd, r1, ic[i].a2, 0);
+		if ((oc & ~0x0f) == O_LD)
+			i_ins(op, rd, r1, r2, 0);
 		if (oc == (O_LD | O_LOC))
 			ra_lload(ic[i].a1, ic[i].a2, rd, O_T(op));
 		if (oc == (O_ST | O_NUM))
 			i_ins(op, 0, r1, r2, ic[i].a3);
+		if ((oc & ~0x0f) == O_ST)
+			i_ins(op, 0, r1, r2, r3);
 		if (oc == (O_ST | O_LOC))
 			ra_lsave(ic[i].a2, ic[i].a3, r1, O_T(op));
 		if (oc == O_RET)
@@ -601,10 +1112,12 @@ static void ic_gencode(struct ic *ic, long ic_n)
 			loc_toadd(ic[i].a1, ic[i].a2, rd);
 		if (oc == (O_MOV | O_SYM))
 			i_ins(op, rd, ic[i].a1, ic[i].a2, 0);
-		if (oc == O_CALL)
-			i_ins(op, rd, r1, 0, 0);
-		if (oc == (O_CALL | O_SYM))
-			i_ins(op, rd, ic[i].a1, ic[i].a2, 0);
+		if ((oc & ~O_RET) == O_CALL)
+			i_ins(op, rd, r1, 0, ic[i].a3 - ic_aregs(&ic[i]));
+		if ((oc & ~O_RET) == (O_CALL | O_SYM))
+			i_ins(op, rd, ic[i].a1,
+				ic[i].a2 + ic_aregs(&ic[i]) * I_REGENT,
+				ic[i].a3 - ic_aregs(&ic[i]));
 		if (oc == O_JMP)
 			i_ins(op, 0, 0, 0, ic[i].a3);
 		if (oc & O_JZ)
@@ -616,7 +1129,7 @@ static void ic_gencode(struct ic *ic, long ic_n)
 		if (oc == O_MCPY)
 			i_ins(op, 0, r1, r2, r3);
 		/* saving back the output register */
-		if (oc & O_OUT && ic_luse[i] > i)
+		if (oc & O_OUT && ic_luse[i] > i && !(oc & O_RET))
 			ra_vsave(ic_i, rd);
 		/* after the last instruction of a basic block */
 		if (i + 1 < ic_n && ic_bbeg[i + 1] && !(oc & O_JXX))
@@ -630,7 +1143,9 @@ static void ic_reset(void)
 	o_tmpdrop(-1);
 	o_back(0);
 	free(loc_off);
+	free(loc_len);
 	loc_off = NULL;
+	loc_len = NULL;
 	loc_n = 0;
 	loc_sz = 0;
 	loc_pos = I_LOC0;
@@ -642,9 +1157,20 @@ Elf_Sym *o_func_beg(char *name, int argc, int global, int varg)
 	func_argc = argc;
 	func_varg = varg;
 	func_regs = 0;
+	func_id = out_sym(name);
+	func_sym = global || varg ? -1 : func_id;
+	/* with I_REGENT, variadic functions take no arguments in registers */
+	func_aregs = !I_REGENT ? N_ARGS : (varg ? 0 : MIN(argc, N_ARGS));
+	if (func_id >= fn_sz) {
+		long sz = MAX(128, (func_id + 1) * 2);
+		fn_keep = mextend(fn_keep, fn_sz, sz, sizeof(fn_keep[0]));
+		fn_aregs = mextend(fn_aregs, fn_sz, sz, sizeof(fn_aregs[0]));
+		fn_sz = sz;
+	}
+	fn_aregs[func_id] = func_aregs;
 	ic_reset();
 	for (i = 0; i < argc; i++)
-		loc_add(I_ARG0 + -i * ULNG);
+		loc_add(I_ARG0 + -i * ULNG, 0);
 	return out_def(name, (global ? OUT_GLOB : 0) | OUT_CS, mem_len(&cs), 0);
 }
 
@@ -666,22 +1192,35 @@ void o_func_end(Elf_Sym *sym)
 	int locs = 0;			/* accessing locals on the stack */
 	int i;
 	ic_get(&ic, &ic_n);		/* the intermediate code */
-	reg_init(ic, ic_n);		/* global register allocation */
+	if (func_sym >= 0)		/* keeping static functions for inlining */
+		ic_inline(func_sym, ic, ic_n, func_argc,
+			loc_len + func_argc, loc_n - func_argc);
+	if (opt(1)) {			/* folding addressing modes */
+		ic_amode(ic, ic_n);
+		ic_memop(ic, ic_n);
+	}
+	func_guard = ic_guard(ic, ic_n);	/* testing early exits before the prologue */
+	reg_init(ic, ic_n, ic_keep(ic, ic_n));	/* global register allocation */
 	ra_init(ic, ic_n);		/* initialize register allocation */
+	loc_layout(ic, ic_n);		/* assigning stack slots to locals */
 	ic_luse = ic_lastuse(ic, ic_n);
+	if (func_guard >= 0 && ic_luse[ic[func_guard].a1] == func_guard)
+		ic_luse[ic[func_guard].a1] = 0;
 	ic_gencode(ic, ic_n);		/* generating machine code */
 	free(ic_luse);
+	/* registers preserved for callers */
+	fn_keep[func_id] = R_TMPS & ~R_PERM & ~func_regs;
 	/* deciding which arguments to save */
 	for (i = 0; i < func_argc; i++)
 		if (loc_mem[i])
 			sargs_last = i + 1;
-	for (i = 0; i < N_ARGS && (func_varg || i < sargs_last); i++)
+	for (i = 0; i < func_aregs && (func_varg || i < sargs_last); i++)
 		sargs |= 1 << argregs[i];
 	/* computing the amount of stack subtraction */
 	for (i = 0; i < loc_n; i++)
 		if (loc_mem[i])
 			locs = 1;
-	spsub = (locs || ra_vmax) ? loc_pos + ra_vmax * ULNG : 0;
+	spsub = (locs || ra_vmax) ? loc_pos : 0;
 	for (i = 0; i < N_TMPS; i++)
 		if (((1 << tmpregs[i]) & func_regs & R_PERM) != 0)
 			spsub += ULNG;
@@ -692,7 +1231,7 @@ void o_func_end(Elf_Sym *sym)
 		if (ic[i].op & O_CALL)
 			leaf = 0;
 	/* adding function prologue and epilogue */
-	i_wrap(func_argc, sargs, spsub, spsub || locs || !leaf,
+	i_wrap(func_argc, func_aregs, sargs, spsub, spsub || locs || !leaf,
 		func_regs & R_PERM, -sregs_pos);
 	ra_done();
 	i_code(&c, &c_len, &rsym, &rflg, &roff, &rcnt);
@@ -730,8 +1269,11 @@ void o_write(int fd)
 
 	out_write(fd, mem_buf(&cs), mem_len(&cs), mem_buf(&ds), mem_len(&ds));
 	free(loc_off);
+	free(loc_len);
 	free(ds_name);
 	free(ds_off);
+	free(fn_keep);
+	free(fn_aregs);
 	mem_done(&cs);
 	mem_done(&ds);
 }
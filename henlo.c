@@ -55,8 +55,12 @@
 #define HIGH(i) ((i >> 8) & 0xFF)
 #define LOW(i) ((i) & 0xFF)
 
-int tmpregs[] = {0, 1, 2};
+int tmpregs[] = {0, 1, 2, 3};
+#ifdef HENLO_REGCALL
+int argregs[] = {0, 1};
+#else
 int argregs[] = {};
+#endif
 
 static struct mem cs;				/* generated code */
 static long *rel_sym;				/* relocation symbols */
@@ -70,6 +74,13 @@ static long jmp_n, jmp_sz;	/* jump count */
 static long *jmp_off;				/* jump offsets */
 static long *jmp_dst;				/* jump destinations */
 static long *jmp_op;				/* jump opcode */
+static long lab_last;				/* the last label of the current function */
+
+static long *tc_sym;				/* tail call symbols */
+static long *tc_jmp;				/* tail call jumps in jmp_off[] */
+static long tc_n, tc_sz;	/* tail call count */
+
+static int cmp_used;				/* R_CMP is modified in the current function */
 
 static long i_load_acc_imm(uint16_t n);
 
@@ -153,6 +164,7 @@ static long i_jmp(long op, long r1, long r2)
 		int is_signed = O_T(op) & T_MSIGN ? 1 : 0;
 		long jmp_instruction = 0;
 
+		cmp_used = 1;
 		// r2/const -> R_AC
 		if (op & O_NUM) {
 			i_load_acc_imm(r2);
@@ -261,18 +273,70 @@ static long i_load_acc_imm(uint16_t n) {
 	return len;
 }
 
+#define IMM_MAX		0x1ff	/* the largest ADDI and MULI immediate */
+#define IMM_SX(n)	((((n) & 0xffff) ^ 0x8000) - 0x8000)
+
+/* the number of instructions to load n into R_AC */
+static int i_load_len(long n)
+{
+	long u = n & 0xffff;
+	return 1 + (u > 255 ? 2 : 0) + (u > 0);
+}
+
+/* rd = r1 + n, using ADDI if it is shorter than loading n into R_AC */
+static void i_addimm(long rd, long r1, long n)
+{
+	long sx = IMM_SX(n);
+	long a = sx < 0 ? -sx : sx;
+	long len = (a + IMM_MAX - 1) / IMM_MAX + (sx < 0 ? 2 : 0);
+	if ((rd != r1) + len > i_load_len(n) + 1) {
+		i_load_acc_imm(n);
+		op_typ(I_ADD, r1, R_AC, rd);
+		return;
+	}
+	if (rd != r1)
+		i_cpy_reg(r1, rd);
+	if (sx < 0)		/* rd - a is -(-rd + a) */
+		op_typ(I_NEG, rd, rd, 0);
+	for (; a > 0; a -= MIN(a, IMM_MAX))
+		op_imm(I_ADDI, rd, MIN(a, IMM_MAX));
+	if (sx < 0)
+		op_typ(I_NEG, rd, rd, 0);
+}
+
+/* rd = r1 * n, using MULI for small n */
+static void i_mulimm(long rd, long r1, long n)
+{
+	long sx = IMM_SX(n);
+	long a = sx < 0 ? -sx : sx;
+	if (a > IMM_MAX) {
+		i_load_acc_imm(n);
+		op_typ(I_MUL, r1, R_AC, rd);
+		return;
+	}
+	if (rd != r1)
+		i_cpy_reg(r1, rd);
+	op_imm(I_MULI, rd, a);
+	if (sx < 0)
+		op_typ(I_NEG, rd, rd, 0);
+}
+
 static void i_ld_num(long rd, long r1, long r2)
 {
-	i_load_acc_imm(r2);
-	op_typ(I_ADD, r1, R_AC, R_AC);
-	op_typ(I_LD, R_AC, rd, 0);
+	if (r2) {
+		i_addimm(R_AC, r1, r2);
+		r1 = R_AC;
+	}
+	op_typ(I_LD, r1, rd, 0);
 }
 
 static void i_st_num(long r1, long r2, long r3)
 {
-	i_load_acc_imm(r3);
-	op_typ(I_ADD, r2, R_AC, R_AC);
-	op_typ(I_ST, r1, R_AC, 0);
+	if (r3) {
+		i_addimm(R_AC, r2, r3);
+		r2 = R_AC;
+	}
+	op_typ(I_ST, r1, r2, 0);
 }
 
 static void i_mul(long rd, long r1, long r2)
@@ -295,32 +359,34 @@ static void i_push(long r1)
 	op_typ(I_ADD, R_SP, R_AC, R_SP);
 }
 
-static void regs_save(long sregs)
+/* save callee-saved registers at FP + dis */
+static void regs_save(long sregs, long dis)
 {
 	int i;
 	for (i = 0; i < N_REGS; i++)
 		if (((1 << i) & R_TMPS) & sregs)
-			i_push(i);
+			i_st_num(i, R_FP, dis++);
 }
 
-static void regs_load(long sregs)
+static void regs_load(long sregs, long dis)
 {
 	int i;
-	for (i = N_REGS - 1; i >= 0; --i)
+	for (i = 0; i < N_REGS; i++)
 		if (((1 << i) & R_TMPS) & sregs)
-			i_pop(i);
+			i_ld_num(i, R_FP, dis++);
 }
 
 static void i_add(long op, long rd, long r1, long r2)
 {
-	if (op & O_SUB) {
+	long t = op & 0x0f;
+	if (t == (O_SUB & 0x0f)) {
 		op_typ(I_NEG, r2, R_AC, 0);
 		op_typ(I_ADD, r1, R_AC, rd);
-	} else if (op & O_AND) {
+	} else if (t == (O_AND & 0x0f)) {
 		op_typ(I_AND, r1, r2, rd);
-	} else if (op & O_OR) {
+	} else if (t == (O_OR & 0x0f)) {
 		op_typ(I_OR, r1, r2, rd);
-	} else if (op & O_XOR) {
+	} else if (t == (O_XOR & 0x0f)) {
 		op_typ(I_XOR, r1, r2, rd);
 	} else {
 		op_typ(I_ADD, r1, r2, rd);
@@ -329,6 +395,11 @@ static void i_add(long op, long rd, long r1, long r2)
 
 static void i_add_anyimm(long op, int rd, int r1, long imm)
 {
+	long t = op & 0x0f;
+	if (t == (O_ADD & 0x0f) || t == (O_SUB & 0x0f)) {
+		i_addimm(rd, r1, t ? -imm : imm);
+		return;
+	}
 	i_load_acc_imm(imm);
 	i_add(op, rd, r1, R_AC);
 }
@@ -358,9 +429,51 @@ static void jmp_add(long op, long off, long dst)
 	jmp_n++;
 }
 
+/* fill the jump at off with the displacement to dst (a lab_loc[] entry) */
+static void jmp_fix(long off, long dst)
+{
+	uint16_t rel_insert_len = 8;
+
+	uint16_t lab_loc_word = dst/2;
+	uint16_t jmp_loc_word = (off + rel_insert_len)/2;
+	uint16_t relative_jmp = lab_loc_word - jmp_loc_word;
+	uint16_t jmp_start = off;
+
+	uint8_t byte_0 = LOW(relative_jmp);
+	uint8_t byte_1 = HIGH(relative_jmp);
+
+	char jmp_instr[] = {
+		HIGH(OP1(I_XOR, R_AC, R_AC, R_AC)),
+		LOW(OP1(I_XOR, R_AC, R_AC, R_AC)),
+		HIGH(OP2(I_ADDI, R_AC, byte_1)),
+		LOW(OP2(I_ADDI, R_AC, byte_1)),
+		HIGH(OP2(I_MULI, R_AC, 256)),
+		LOW(OP2(I_MULI, R_AC, 256)),
+		HIGH(OP2(I_ADDI, R_AC, byte_0)),
+		LOW(OP2(I_ADDI, R_AC, byte_0))
+	};
+
+	mem_cpy(&cs, jmp_start, jmp_instr, rel_insert_len);
+}
+
 void i_label(long id)
 {
 	lab_add(id + 1);
+	lab_last = id + 1;
+}
+
+/* jump to the exit of a tail call, generated in i_wrap() */
+static void i_tailcall(long sym)
+{
+	if (tc_n == tc_sz) {
+		tc_sz = MAX(16, tc_sz * 2);
+		tc_sym = mextend(tc_sym, tc_n, tc_sz, sizeof(*tc_sym));
+		tc_jmp = mextend(tc_jmp, tc_n, tc_sz, sizeof(*tc_jmp));
+	}
+	tc_sym[tc_n] = sym;
+	tc_jmp[tc_n] = jmp_n;
+	tc_n++;
+	jmp_add(O_JMP, i_jmp(O_JMP, 0, 0), 0);
 }
 
 static void i_rel(long sym, long flg, long off)
@@ -377,12 +490,339 @@ static void i_rel(long sym, long flg, long off)
 	rel_n++;
 }
 
+static void i_call(long sym)
+{
+	cmp_used = 1;
+#ifdef HENLO_REGCALL
+	// The return address, PC + 5, is passed in R_CMP
+	op_typ(I_XOR, R_AC, R_AC, R_AC);
+	op_imm(I_ADDI, R_AC, 5);
+	op_typ(I_ADD, R_PC, R_AC, R_CMP);
+#else
+	// We want to store PC + 11 on the stack
+	op_typ(I_XOR, R_AC, R_AC, R_AC);
+	op_imm(I_ADDI, R_AC, 11);
+	op_typ(I_ADD, R_PC, R_AC, R_CMP); // R_CMP contains PC to save
+
+	// increment RSP and store PC to save
+	op_typ(I_XOR, R_AC, R_AC, R_AC);
+	op_imm(I_ADDI, R_AC, 1);
+	op_typ(I_NEG, R_AC, R_AC, 0);
+	op_typ(I_ADD, R_SP, R_AC, R_SP);
+	op_typ(I_ST, R_CMP, R_SP, 0);
+	op_typ(I_ADD, R_SP, R_AC, R_SP);
+#endif
+
+	i_rel(sym, OUT_CS | OUT_RLREL, opos());
+	oi(0, 8);
+	oi(OP3(I_JMP, R_AC, 0, JMP_ABS), 2);
+}
+
+/*
+ * Runtime helpers for division, modulo and variable shifts.  The
+ * operands are passed in R0 and R1 and the result is returned in R0;
+ * R1, R2, R_CMP and R_AC are clobbered.  Only the helpers referenced
+ * in the object are generated, in i_done().
+ */
+#define HL_UDIV		0	/* unsigned division */
+#define HL_UMOD		1	/* unsigned modulo */
+#define HL_DIV		2	/* signed division */
+#define HL_MOD		3	/* signed modulo */
+#define HL_LSHR		4	/* logical right shift */
+#define HL_ASHR		5	/* arithmetic right shift */
+#define HL_SHL		6	/* left shift */
+
+static char *hl_names[] = {
+	"__udivhi3", "__umodhi3", "__divhi3", "__modhi3",
+	"__lshrhi3", "__ashrhi3", "__ashlhi3",
+};
+static int hl_used;		/* helpers referenced in this object */
+
+#define HL_TOPBIT	0x8000
+#define HL_SHRSTEP	9	/* the length of i_shrstep() in words */
+#define HL_SHRINL	3	/* the maximum number of inlined i_shrstep() */
+
+static void i_hlcall(int hl)
+{
+	hl_used |= 1 << hl;
+	i_call(out_sym(hl_names[hl]));
+}
+
+/* save the return address of a helper like the default i_call() */
+static void hl_enter(void)
+{
+#ifdef HENLO_REGCALL
+	i_add_anyimm(0, R_SP, R_SP, -1);
+	i_push(R_CMP);
+#endif
+}
+
+/* return from a helper, also releasing the slot of the return address */
+static void hl_ret(void)
+{
+	i_pop(R_CMP);
+	i_add_anyimm(0, R_SP, R_SP, 1);
+	i_cpy_reg(R_CMP, R_PC);
+}
+
+/* shift the top bit of R0 into R2; R1 holds HL_TOPBIT */
+static void i_shrstep(void)
+{
+	long off;
+	cmp_used = 1;
+	op_typ(I_ADD, R_R2, R_R2, R_R2);
+	op_typ(I_AND, R_R0, R_R1, R_CMP);
+	off = i_jmp(O_JZ, R_CMP, 0);
+	op_imm(I_ADDI, R_R2, 1);
+	jmp_fix(off, opos() - 1);
+	op_typ(I_ADD, R_R0, R_R0, R_R0);
+}
+
+/* R0 = R0 >> R1 (logical); jumps into 16 unrolled i_shrstep() */
+static void hl_lshr(void)
+{
+	int i;
+	i_add_anyimm(O_AND & 0xf, R_R1, R_R1, 15);
+	op_imm(I_MULI, R_R1, HL_SHRSTEP);
+	i_cpy_reg(R_R1, R_CMP);
+	i_load_acc_imm(HL_TOPBIT);
+	i_cpy_reg(R_AC, R_R1);
+	op_typ(I_XOR, R_R2, R_R2, R_R2);
+	i_cpy_reg(R_CMP, R_AC);
+	op_rrf(I_JMP, R_AC, 0, JMP_REL);
+	for (i = 0; i < 16; i++)
+		i_shrstep();
+	i_cpy_reg(R_R2, R_R0);
+}
+
+/* R0 = R0 >> R1 (arithmetic): ~(~R0 >> R1) for negative R0 */
+static void hl_ashr(void)
+{
+	long off;
+	i_push(R_FP);
+	op_typ(I_XOR, R_FP, R_FP, R_FP);
+	off = i_jmp(O_MK(O_JCC | O_NUM | (O_GE & 0xf), T_MSIGN), R_R0, 0);
+	i_add_anyimm(0, R_FP, R_FP, -1);
+	jmp_fix(off, opos() - 1);
+	op_typ(I_XOR, R_R0, R_FP, R_R0);
+	hl_lshr();
+	op_typ(I_XOR, R_R0, R_FP, R_R0);
+	i_pop(R_FP);
+}
+
+/* R0 = R0 << R1; jumps into 15 unrolled doublings */
+static void hl_shl(void)
+{
+	int i;
+	i_add_anyimm(O_AND & 0xf, R_R1, R_R1, 15);
+	op_typ(I_NEG, R_R1, R_AC, 0);
+	op_imm(I_ADDI, R_AC, 15);
+	op_rrf(I_JMP, R_AC, 0, JMP_REL);
+	for (i = 0; i < 15; i++)
+		op_typ(I_ADD, R_R0, R_R0, R_R0);
+}
+
+/*
+ * Unsigned shift-subtract division: R0 = R0 / R1 and R2 = R0 % R1.
+ * The leading zero bits of the dividend are skipped and the quotient
+ * bits replace the dividend bits shifted out of R0.  R_FP is used as
+ * the counter.  Division by zero yields zero.
+ */
+static void hl_udiv(void)
+{
+	long small0, small1, end0, end1;
+	long off, loop;
+	op_typ(I_XOR, R_R2, R_R2, R_R2);
+	small0 = i_jmp(O_JZ, R_R1, 0);
+	small1 = i_jmp(O_JCC | (O_LT & 0xf), R_R0, R_R1);
+	/* the quotient is one if the top bit of the divisor is set */
+	i_load_acc_imm(HL_TOPBIT);
+	op_typ(I_AND, R_R1, R_AC, R_CMP);
+	off = i_jmp(O_JZ, R_CMP, 0);
+	op_typ(I_NEG, R_R1, R_AC, 0);
+	op_typ(I_ADD, R_R0, R_AC, R_R2);
+	op_typ(I_XOR, R_R0, R_R0, R_R0);
+	op_imm(I_ADDI, R_R0, 1);
+	end0 = i_jmp(O_JMP, 0, 0);
+	jmp_fix(off, opos() - 1);
+	/* skipping the leading zero bits of the dividend */
+	op_typ(I_XOR, R_FP, R_FP, R_FP);
+	op_imm(I_ADDI, R_FP, 16);
+	loop = opos() - 1;
+	i_load_acc_imm(HL_TOPBIT);
+	op_typ(I_AND, R_R0, R_AC, R_CMP);
+	off = i_jmp(O_JNZ, R_CMP, 0);
+	op_typ(I_ADD, R_R0, R_R0, R_R0);
+	i_add_anyimm(0, R_FP, R_FP, -1);
+	jmp_fix(i_jmp(O_JMP, 0, 0), loop);
+	jmp_fix(off, opos() - 1);
+	/* the main loop */
+	loop = opos() - 1;
+	op_typ(I_ADD, R_R2, R_R2, R_R2);
+	i_load_acc_imm(HL_TOPBIT);
+	op_typ(I_AND, R_R0, R_AC, R_CMP);
+	off = i_jmp(O_JZ, R_CMP, 0);
+	op_imm(I_ADDI, R_R2, 1);
+	jmp_fix(off, opos() - 1);
+	op_typ(I_ADD, R_R0, R_R0, R_R0);
+	off = i_jmp(O_JCC | (O_LT & 0xf), R_R2, R_R1);
+	op_typ(I_NEG, R_R1, R_AC, 0);
+	op_typ(I_ADD, R_R2, R_AC, R_R2);
+	op_imm(I_ADDI, R_R0, 1);
+	jmp_fix(off, opos() - 1);
+	i_add_anyimm(0, R_FP, R_FP, -1);
+	jmp_fix(i_jmp(O_JNZ, R_FP, 0), loop);
+	end1 = i_jmp(O_JMP, 0, 0);
+	/* the dividend is smaller than the divisor */
+	jmp_fix(small0, opos() - 1);
+	jmp_fix(small1, opos() - 1);
+	i_cpy_reg(R_R0, R_R2);
+	op_typ(I_XOR, R_R0, R_R0, R_R0);
+	jmp_fix(end0, opos() - 1);
+	jmp_fix(end1, opos() - 1);
+}
+
+static void hl_udivmod(int mod)
+{
+	i_push(R_FP);
+	hl_udiv();
+	if (mod)
+		i_cpy_reg(R_R2, R_R0);
+	i_pop(R_FP);
+}
+
+/* signed division and modulo; the remainder takes the sign of the dividend */
+static void hl_divmod(int mod)
+{
+	long off;
+	i_push(R_FP);
+	op_typ(I_XOR, R_FP, R_FP, R_FP);
+	off = i_jmp(O_MK(O_JCC | O_NUM | (O_GE & 0xf), T_MSIGN), R_R0, 0);
+	op_typ(I_NEG, R_R0, R_R0, 0);
+	op_imm(I_ADDI, R_FP, 1);
+	jmp_fix(off, opos() - 1);
+	off = i_jmp(O_MK(O_JCC | O_NUM | (O_GE & 0xf), T_MSIGN), R_R1, 0);
+	op_typ(I_NEG, R_R1, R_R1, 0);
+	if (!mod) {
+		i_load_acc_imm(1);
+		op_typ(I_XOR, R_FP, R_AC, R_FP);
+	}
+	jmp_fix(off, opos() - 1);
+	i_push(R_FP);
+	hl_udiv();
+	i_pop(R_FP);
+	if (mod)
+		i_cpy_reg(R_R2, R_R0);
+	off = i_jmp(O_JZ, R_FP, 0);
+	op_typ(I_NEG, R_R0, R_R0, 0);
+	jmp_fix(off, opos() - 1);
+	i_pop(R_FP);
+}
+
+/* generate helper hl and append it to the object */
+static void hl_emit(int hl)
+{
+	char *c;
+	long c_len;
+	hl_enter();
+	if (hl == HL_UDIV || hl == HL_UMOD)
+		hl_udivmod(hl == HL_UMOD);
+	if (hl == HL_DIV || hl == HL_MOD)
+		hl_divmod(hl == HL_MOD);
+	if (hl == HL_LSHR)
+		hl_lshr();
+	if (hl == HL_ASHR)
+		hl_ashr();
+	if (hl == HL_SHL)
+		hl_shl();
+	hl_ret();
+	c_len = mem_len(&cs);
+	c = mem_get(&cs);
+	o_code(hl_names[hl], c, c_len);
+	free(c);
+}
+
+/* R0 = R0 >> n; short logical shifts are inlined */
+static void i_shrnum(long bt, long n)
+{
+	int i;
+	n &= 15;
+	if (!n)
+		return;
+	if (!(bt & T_MSIGN) && 16 - n <= HL_SHRINL) {
+		op_typ(I_XOR, R_R2, R_R2, R_R2);
+		i_load_acc_imm(HL_TOPBIT);
+		i_cpy_reg(R_AC, R_R1);
+		for (i = n; i < 16; i++)
+			i_shrstep();
+		i_cpy_reg(R_R2, R_R0);
+		return;
+	}
+	i_load_acc_imm(n);
+	i_cpy_reg(R_AC, R_R1);
+	i_hlcall(bt & T_MSIGN ? HL_ASHR : HL_LSHR);
+}
+
+/* R0 = R0 / n or R0 % n; division by powers of two is inlined */
+static void i_divnum(long op, long n)
+{
+	long oc = O_C(op);
+	long bt = O_T(op);
+	int mod = oc == (O_MOD | O_NUM);
+	int k = 0;
+	if (bt & T_MSIGN && (n == 1 || n == -1)) {
+		if (mod)
+			op_typ(I_XOR, R_R0, R_R0, R_R0);
+		else if (n < 0)
+			op_typ(I_NEG, R_R0, R_R0, 0);
+		return;
+	}
+	if (!(bt & T_MSIGN)) {
+		n &= 0xffff;
+		while (k < 16 && n != 1 << k)
+			k++;
+		if (k < 16 && mod)
+			i_add_anyimm(O_AND & 0xf, R_R0, R_R0, n - 1);
+		if (k < 16 && !mod)
+			i_shrnum(bt, k);
+		if (k < 16)
+			return;
+	}
+	i_load_acc_imm(n);
+	i_cpy_reg(R_AC, R_R1);
+	if (bt & T_MSIGN)
+		i_hlcall(mod ? HL_MOD : HL_DIV);
+	else
+		i_hlcall(mod ? HL_UMOD : HL_UDIV);
+}
+
+/* copy or fill rn words at rd; the memory is word addressed */
+static void i_mem(int cpy, long rd, long rs, long rn)
+{
+	long loop = opos() - 1;
+	long end = i_jmp(O_JZ, rn, 0);
+	if (cpy) {
+		cmp_used = 1;
+		op_typ(I_LD, rs, R_CMP, 0);
+		op_typ(I_ST, R_CMP, rd, 0);
+		i_add_anyimm(0, rs, rs, 1);
+	} else {
+		op_typ(I_ST, rs, rd, 0);
+	}
+	i_add_anyimm(0, rd, rd, 1);
+	i_add_anyimm(0, rn, rn, -1);
+	jmp_fix(i_jmp(O_JMP, 0, 0), loop);
+	jmp_fix(end, opos() - 1);
+}
+
 static void i_sym(int rd, int sym, int off)
 {
 }
 
 static void i_subsp(long val)
 {
+	if (val)
+		i_add_anyimm(0, R_SP, R_SP, -val);
 }
 
 static int regs_count(long regs)
@@ -395,7 +835,57 @@ static int regs_count(long regs)
 	return cnt;
 }
 
-void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs_pos)
+/*
+ * With HENLO_REGCALL, the first N_ARGS arguments are passed in
+ * registers and the return address in R_CMP.  If the arguments or
+ * the return address need saving, FRAME_SZ slots are reserved below
+ * the stack arguments, giving the same argument layout relative to
+ * FP as the default convention, in which i_call() pushes the return
+ * address.
+ */
+#define FRAME_SZ	(N_ARGS + 2)	/* arguments, return address and FP */
+
+static void i_prologue(long sargs, int initfp)
+{
+#ifdef HENLO_REGCALL
+	int i;
+	if (initfp || cmp_used) {
+		i_add_anyimm(0, R_SP, R_SP, -FRAME_SZ);
+		for (i = 0; i < N_ARGS; i++)
+			if ((1 << argregs[i]) & sargs)
+				i_st_num(argregs[i], R_SP, 2 + i);
+		if (cmp_used)
+			i_st_num(R_CMP, R_SP, 1);
+	}
+#endif
+	if (initfp) {
+		i_push(R_FP);
+		i_cpy_reg(R_SP, R_FP);
+	}
+}
+
+/* release the frame; with HENLO_REGCALL, R_CMP holds the return address */
+static void i_epilogue(int initfp)
+{
+	if (initfp) {
+		i_cpy_reg(R_FP, R_SP);
+		i_pop(R_FP);
+	}
+#ifdef HENLO_REGCALL
+	if (cmp_used)
+		i_ld_num(R_CMP, R_SP, 1);
+	if (initfp || cmp_used)
+		i_add_anyimm(0, R_SP, R_SP, FRAME_SZ);
+#endif
+}
+
+/* entry guards are not supported; the prologue is always executed */
+long i_guard(long op, long r1, long r2, long rop, long ret)
+{
+	return 1;
+}
+
+void i_wrap(int argc, int aregs, long sargs, long spsub, int initfp, long sregs, long sregs_pos)
 {
 	void *old_body;
 	long old_body_len;
@@ -410,13 +900,11 @@ void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs
 	// mem_get zeroes out the cs struct, but does not free old_body
 	old_body = mem_get(&cs);
 
-	if (initfp) {
-		i_push(R_FP);
-		i_cpy_reg(R_SP, R_FP);
-	}
+	i_prologue(sargs, initfp);
+	i_subsp(spsub);
 
 	if (sregs) {
-		regs_save(sregs);
+		regs_save(sregs, sregs_pos);
 	}
 
 	diff = mem_len(&cs);
@@ -424,14 +912,15 @@ void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs
 	free(old_body);
 
 	if (sregs) {
-		regs_load(sregs);
+		regs_load(sregs, sregs_pos);
 	}
 
-	if (initfp) {
-		i_cpy_reg(R_FP, R_SP);
-		i_pop(R_FP);
-	}
+	i_epilogue(initfp);
+#ifdef HENLO_REGCALL
+	i_cpy_reg(R_CMP, R_PC);
+#else
 	i_pop(R_PC);
+#endif
 
 	// Now that we've added a prologue, offsets should be bumped
 	for (i = 0; i < rel_n; i++) {
@@ -443,6 +932,21 @@ void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs
 	for (i = 0; i < lab_sz; i++) {
 		lab_loc[i] += diff;
 	}
+
+	// Tail call exits: release the frame like the epilogue and jump to the callee
+	for (i = 0; i < tc_n; i++) {
+		jmp_dst[tc_jmp[i]] = lab_last + 1 + i;
+		lab_add(lab_last + 1 + i);
+		if (sregs) {
+			regs_load(sregs, sregs_pos);
+		}
+		i_epilogue(initfp);
+		i_rel(tc_sym[i], OUT_CS | OUT_RLREL, opos());
+		oi(0, 8);
+		oi(OP3(I_JMP, R_AC, 0, JMP_ABS), 2);
+	}
+	tc_n = 0;
+	cmp_used = 0;
 }
 
 void i_code(char **c, long *c_len, long **rsym, long **rflg, long **roff, long *rcnt)
@@ -450,30 +954,8 @@ void i_code(char **c, long *c_len, long **rsym, long **rflg, long **roff, long *
 	int i;
 
 	// Fill in all of the relative jump offsets
-	for (i = 0; i < jmp_n; i++) {
-		uint16_t rel_insert_len = 8;
-
-		uint16_t lab_loc_word = lab_loc[jmp_dst[i]]/2;
-		uint16_t jmp_loc_word = (jmp_off[i] + rel_insert_len)/2;
-		uint16_t relative_jmp = lab_loc_word - jmp_loc_word;
-		uint16_t jmp_start = jmp_off[i];
-
-		uint8_t byte_0 = LOW(relative_jmp);
-		uint8_t byte_1 = HIGH(relative_jmp);
-
-		char jmp_instr[] = {
-			HIGH(OP1(I_XOR, R_AC, R_AC, R_AC)),
-			LOW(OP1(I_XOR, R_AC, R_AC, R_AC)),
-			HIGH(OP2(I_ADDI, R_AC, byte_1)),
-			LOW(OP2(I_ADDI, R_AC, byte_1)),
-			HIGH(OP2(I_MULI, R_AC, 256)),
-			LOW(OP2(I_MULI, R_AC, 256)),
-			HIGH(OP2(I_ADDI, R_AC, byte_0)),
-			LOW(OP2(I_ADDI, R_AC, byte_0))
-		};
-
-		mem_cpy(&cs, jmp_start, jmp_instr, rel_insert_len);
-	}
+	for (i = 0; i < jmp_n; i++)
+		jmp_fix(jmp_off[i], lab_loc[jmp_dst[i]]);
 
 	*c_len = mem_len(&cs);
 	*c = mem_get(&cs);
@@ -491,10 +973,16 @@ void i_code(char **c, long *c_len, long **rsym, long **rflg, long **roff, long *
 
 void i_done(void)
 {
+	int i;
+	for (i = 0; i < LEN(hl_names); i++)
+		if (hl_used & (1 << i))
+			hl_emit(i);
 	free(jmp_off);
 	free(jmp_dst);
 	free(jmp_op);
 	free(lab_loc);
+	free(tc_sym);
+	free(tc_jmp);
 }
 
 long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
@@ -506,6 +994,9 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 	*r2 = 0;
 	*r3 = 0;
 	*tmp = 0;
+	/* no memory operands */
+	if (oc & O_IND)
+		return 1;
 	if (oc & O_MOV) {
 		*rd = R_TMPS;
 		if (oc & (O_NUM | O_SYM))
@@ -520,22 +1011,37 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 		return 0;
 	}
 	if (oc & O_SHL) {
-		if (oc & O_NUM) {
+		if (oc == (O_SHL | O_NUM)) {
 			*r1 = R_TMPS;
 			*r2 = 8;
-		} else {
-			*r1 = R_TMPS;
-			*r2 = R_TMPS;
+			return 0;
 		}
+		/* the operands of runtime helpers; see i_hlcall() */
+		*rd = 1 << R_R0;
+		*r1 = 1 << R_R0;
+		*r2 = oc & O_NUM ? 8 : 1 << R_R1;
+		*tmp = R_TMPS;
 		return 0;
 	}
 	if (oc & O_MUL) {
-		if (oc & O_NUM)
+		if (oc == O_MULH)
 			return 1;
-		*rd = R_TMPS;
-		*r1 = R_TMPS;
-		*r2 = R_TMPS;
-		*tmp = 0;
+		if (oc == (O_MUL | O_NUM)) {
+			*r1 = R_TMPS;
+			*r2 = 16;
+			return 0;
+		}
+		if (oc == O_MUL) {
+			*rd = R_TMPS;
+			*r1 = R_TMPS;
+			*r2 = R_TMPS;
+			*tmp = 0;
+			return 0;
+		}
+		*rd = 1 << R_R0;
+		*r1 = 1 << R_R0;
+		*r2 = oc & O_NUM ? 16 : 1 << R_R1;
+		*tmp = R_TMPS;
 		return 0;
 	}
 	if (oc & O_CMP) {
@@ -551,30 +1057,28 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 			*r1 = R_TMPS;
 		return 0;
 	}
-	if (oc == O_MSET) {
-		*r1 = R_TMPS;
-		*r2 = R_TMPS;
-		*r3 = R_TMPS;
-		*tmp = 0;
-		return 0;
-	}
-	if (oc == O_MCPY) {
-		*r1 = R_TMPS;
-		*r2 = R_TMPS;
-		*r3 = R_TMPS;
-		*tmp = 0;
+	if (oc == O_MSET || oc == O_MCPY) {
+		*r1 = 1 << R_R0;
+		*r2 = 1 << R_R1;
+		*r3 = 1 << R_R2;
+		*tmp = R_TMPS;
 		return 0;
 	}
 	if (oc == O_RET) {
+		/* i_call() loads the return address in R_CMP */
 		*r1 = (1 << REG_RET);
+		*tmp = 1 << R_CMP;
 		return 0;
 	}
 	if (oc & O_CALL) {
 		*rd = (1 << REG_RET);
 		*r1 = oc & O_SYM ? 0 : R_TMPS;
 		*tmp = R_TMPS & ~R_PERM;
-		return 0;
+		return oc & O_RET && !(oc & O_SYM);
 	}
+	/* henlo has no indexed addressing */
+	if ((oc & ~0x0f) == O_LD || (oc & ~0x0f) == O_ST)
+		return 1;
 	if (oc & O_LD) {
 		*rd = R_TMPS;
 		*r1 = R_TMPS;
@@ -592,8 +1096,10 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 		return 0;
 	}
 	if (oc & O_JCC) {
-		*r1 = R_TMPS;
+		/* the comparison is computed in R_CMP; see i_jmp() */
+		*r1 = R_TMPS & ~(1 << R_CMP);
 		*r2 = oc & O_NUM ? 8 : R_TMPS;
+		*tmp = 1 << R_CMP;
 		return 0;
 	}
 	if (oc == O_JMP) {
@@ -750,6 +1256,9 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 	long offset = 0;
 
 	print_op(oc, rd, r1, r2, r3, bt);
+	/* R_CMP is allocatable; with HENLO_REGCALL, the prologue saves it */
+	if (rd == R_CMP)
+		cmp_used = 1;
 
 	if (oc & O_ADD) {
 		if (oc & O_NUM) {
@@ -761,20 +1270,21 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 	}
 
 	if (oc & O_SHL) {
-		if (oc & O_NUM) {
-			if (oc == O_SHR) {
-				printf("O_SHR");
-				die("Shift right not yet supported");
-			}
-			else if (r2 < 16) {
-				int mul = 1;
-				for (int i = 0; i < r2; i++) {
-					mul *= 2;
-				}
-				i_load_acc_imm(mul);
-				op_typ(I_MUL, r1, R_AC, rd);
-				return 0;
-			}
+		if (oc == (O_SHL | O_NUM) && r2 < 16) {
+			i_mulimm(rd, r1, 1 << r2);
+			return 0;
+		}
+		if (oc == (O_SHR | O_NUM)) {
+			i_shrnum(bt, r2);
+			return 0;
+		}
+		if (oc == O_SHR) {
+			i_hlcall(bt & T_MSIGN ? HL_ASHR : HL_LSHR);
+			return 0;
+		}
+		if (oc == O_SHL) {
+			i_hlcall(HL_SHL);
+			return 0;
 		}
 		die("Shift not yet supported");
 		return 0;
@@ -784,11 +1294,17 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 		if (oc == O_MUL) {
 			i_mul(rd, r1, r2);
 		}
+		if (oc == (O_MUL | O_NUM)) {
+			i_mulimm(rd, r1, r2);
+		}
+		if (oc == (O_DIV | O_NUM) || oc == (O_MOD | O_NUM)) {
+			i_divnum(op, r2);
+		}
 		if (oc == O_DIV) {
-			die("div");
+			i_hlcall(bt & T_MSIGN ? HL_DIV : HL_UDIV);
 		}
 		if (oc == O_MOD) {
-			die("mod");
+			i_hlcall(bt & T_MSIGN ? HL_MOD : HL_UMOD);
 		}
 		return 0;
 	}
@@ -812,28 +1328,25 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 		return 0;
 	}
 
+	if (oc == (O_CALL | O_SYM | O_RET)) {
+		long i;
+		// Move stack arguments over the incoming ones
+		cmp_used |= r3 > 0;
+		for (i = 0; i < r3; i++) {
+			i_ld_num(R_CMP, R_SP, i * ULNG);
+			i_st_num(R_CMP, R_FP, -I_ARG0 + i * ULNG);
+		}
+		i_tailcall(r1);
+		return 0;
+	}
+
 	if (oc == O_CALL) {
 		die("nonsymbolic call");
 		return 0;
 	}
 
 	if (oc == (O_CALL | O_SYM)) {
-		// We want to store PC + 11 on the stack
-		op_typ(I_XOR, R_AC, R_AC, R_AC);
-		op_imm(I_ADDI, R_AC, 11);
-		op_typ(I_ADD, R_PC, R_AC, R_CMP); // R_CMP contains PC to save
-
-		// increment RSP and store PC to save
-		op_typ(I_XOR, R_AC, R_AC, R_AC);
-		op_imm(I_ADDI, R_AC, 1);
-		op_typ(I_NEG, R_AC, R_AC, 0);
-		op_typ(I_ADD, R_SP, R_AC, R_SP);
-		op_typ(I_ST, R_CMP, R_SP, 0);
-		op_typ(I_ADD, R_SP, R_AC, R_SP);
-
-		i_rel(r1, OUT_CS | OUT_RLREL, opos());
-		oi(0, 8);
-		oi(OP3(I_JMP, R_AC, 0, JMP_ABS), 2);
+		i_call(r1);
 		return 0;
 	}
 
@@ -853,13 +1366,8 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 		return 0;
 	}
 
-	if (oc == O_MSET) {
-		die("mset");
-		return 0;
-	}
-
-	if (oc == O_MCPY) {
-		die("mcpy");
+	if (oc == O_MSET || oc == O_MCPY) {
+		i_mem(oc == O_MCPY, r1, r2, r3);
 		return 0;
 	}
 
@@ -3,14 +3,24 @@
 #define I_ARCH		"__henlo__"
 
 #define N_REGS		8	/* number of registers */
-#define N_TMPS		3	/* number of tmp registers */
+#define N_TMPS		4	/* number of tmp registers */
+#ifdef HENLO_REGCALL		/* passing arguments in registers */
+#define N_ARGS		2	/* number of arg registers */
+#define R_TMPS		0x000f	/* mask of tmp registers */
+#define R_ARGS		0x0003	/* mask of arg registers */
+#else
 #define N_ARGS		0	/* number of arg registers */
-#define R_TMPS		0x0007	/* mask of tmp registers */
+#define R_TMPS		0x000f	/* mask of tmp registers */
 #define R_ARGS		0x0000	/* mask of arg registers */
-#define R_PERM		0x0000	/* mask of callee-saved registers */
+#endif
+#define R_PERM		0x0004	/* mask of callee-saved registers */
 
 #define REG_FP		4	/* frame pointer register */
 #define REG_SP		5	/* stack pointer register */
 
 #define I_ARG0		(-3)	/* offset of the first argument from FP */
 #define I_LOC0		0	/* offset of the first local from FP */
+#define I_REGENT	0	/* all functions take arguments in registers */
+
+#define I_MEMMAX	8	/* the longest unrolled block copy or fill */
+#define I_MEMWORD	1	/* the widest access in unrolled blocks */
@@ -11,16 +11,32 @@ static long iv_n;		/* number of values in iv[] */
 static long *lab_loc;		/* label locations */
 static long lab_n, lab_sz;	/* number of labels in lab_loc[] */
 static long lab_last;		/* the last label target */
+static long ic_stat_cse;	/* eliminated common subexpressions */
+static long ic_stat_licm;	/* hoisted loop invariants */
+static long ic_stat_ivsr;	/* array accesses using induction pointers */
+static long ic_stat_ivdead;	/* removed induction variables */
+static long ic_stat_inline;	/* inlined function calls */
+static long ic_stat_rot;	/* rotated loops */
+static long ic_stat_order;	/* reordered binary operands */
 
 static int io_num(void);
 static int io_mul2(void);
+static int io_div(void);
 static int io_cmp(void);
 static int io_jmp(void);
 static int io_addr(void);
 static int io_loc(void);
 static int io_imm(void);
+static int io_order(void);
+static int io_mem(long oc, long r0, long r1, long r2);
 static int io_call(void);
+static int io_inline(long fn, long *args, int argc, int ret);
+static int io_retcall(int ret);
 static void io_deadcode(void);
+static void io_gvn(void);
+static void io_licm(void);
+static void io_ivsr(void);
+static void io_layout(void);
 
 static void iv_put(long n);
 
@@ -136,8 +152,11 @@ static int ic_load(long iv)
 
 void o_bop(long op)
 {
-	int r1 = iv_pop();
-	int r2 = iv_pop();
+	int r1, r2;
+	if (opt(1))
+		io_order();
+	r1 = iv_pop();
+	r2 = iv_pop();
 	/* load constants as late as possible */
 	if (opt(1) && ic_const(r2) && !ic_const(r1)) {
 		ic_put(ic[r2].op, ic[r2].a1, ic[r2].a2, ic[r2].a3);
@@ -147,6 +166,7 @@ void o_bop(long op)
 	if (opt(1)) {
 		io_num();
 		io_mul2();
+		io_div();
 		io_addr();
 		io_imm();
 	}
@@ -200,6 +220,8 @@ void o_memcpy(void)
 	int r2 = iv_pop();
 	int r1 = iv_pop();
 	int r0 = iv_pop();
+	if (opt(1) && !io_mem(O_MCPY, r0, r1, r2))
+		return;
 	ic_put(O_MCPY, r0, r1, r2);
 }
 
@@ -208,6 +230,8 @@ void o_memset(void)
 	int r2 = iv_pop();
 	int r1 = iv_pop();
 	int r0 = iv_pop();
+	if (opt(1) && !io_mem(O_MSET, r0, r1, r2))
+		return;
 	ic_put(O_MSET, r0, r1, r2);
 }
 
@@ -227,6 +251,10 @@ void o_call(int argc, int ret)
 		}
 	}
 	r1 = iv_pop();
+	if (opt(1) && !io_inline(r1, args, argc, ret)) {
+		free(args);
+		return;
+	}
 	c = ic_put(O_CALL, r1, 0, argc);
 	c->args = args;
 	iv_drop(ret == 0);
@@ -238,6 +266,8 @@ void o_ret(int ret)
 {
 	if (!ret)
 		o_num(0);
+	if (ret && opt(1))
+		io_retcall(ret);
 	ic_put(O_RET, iv_pop(), 0, 0);
 }
 
@@ -298,8 +328,17 @@ void ic_get(struct ic **c, long *n)
 		o_ret(0);
 	for (i = 0; i < ic_n; i++)	/* filling branch targets */
 		if (ic[i].op & O_JXX)
-			ic[i].a3 = lab_loc[ic[i].a3];
+			ic[i].a3 = ic[i].a3 >= 0 ? lab_loc[ic[i].a3] : -ic[i].a3 - 1;
 	io_deadcode();			/* removing dead code */
+	if (opt(2)) {
+		io_gvn();		/* eliminating common subexpressions */
+		io_licm();		/* moving loop invariants out of loops */
+		io_ivsr();		/* strength reduction of array indexing */
+	}
+	if (opt(1)) {
+		io_layout();		/* ordering basic blocks */
+		io_deadcode();
+	}
 	*c = ic;
 	*n = ic_n;
 	ic = NULL;
@@ -313,6 +352,25 @@ void ic_get(struct ic **c, long *n)
 	lab_last = 0;
 }
 
+/* print optimisation statistics */
+void ic_stats(void)
+{
+	fprintf(stderr, "neatcc: %ld common subexpressions eliminated\n",
+		ic_stat_cse);
+	fprintf(stderr, "neatcc: %ld loop invariants hoisted\n",
+		ic_stat_licm);
+	fprintf(stderr, "neatcc: %ld array indices strength reduced\n",
+		ic_stat_ivsr);
+	fprintf(stderr, "neatcc: %ld induction variables removed\n",
+		ic_stat_ivdead);
+	fprintf(stderr, "neatcc: %ld function calls inlined\n",
+		ic_stat_inline);
+	fprintf(stderr, "neatcc: %ld loops rotated\n",
+		ic_stat_rot);
+	fprintf(stderr, "neatcc: %ld binary operands reordered\n",
+		ic_stat_order);
+}
+
 void ic_free(struct ic *ic)
 {
 	if (ic->op & O_CALL)
@@ -501,9 +559,9 @@ int ic_regcnt(struct ic *ic)
 	if (o & O_RET)
 		return 1;
 	if (o & O_LD)
-		return ((o & O_NUM) != 0);
+		return o & (O_SYM | O_LOC) ? 0 : 1 + !(o & O_NUM);
 	if (o & O_ST)
-		return 1 + ((o & O_NUM) != 0);
+		return o & (O_SYM | O_LOC) ? 1 : 2 + !(o & O_NUM);
 	return 0;
 }
 
@@ -514,7 +572,8 @@ int ic_regcnt(struct ic *ic)
 long *ic_lastuse(struct ic *ic, long ic_n)
 {
 	long *luse = calloc(ic_n, sizeof(luse[0]));
-	int i, j;
+	long *lend, *beg, *end;
+	long i, j, top = 0;
 	for (i = ic_n - 1; i >= 0; --i) {
 		int n = ic_regcnt(ic + i);
 		if (!luse[i])
@@ -533,9 +592,290 @@ long *ic_lastuse(struct ic *ic, long ic_n)
 				if (!luse[ic[i].args[j]])
 					luse[ic[i].args[j]] = i;
 	}
+	/* values used inside loops should survive until their back edges */
+	lend = malloc(ic_n * sizeof(lend[0]));
+	beg = malloc(ic_n * sizeof(beg[0]));
+	end = malloc(ic_n * sizeof(end[0]));
+	for (i = 0; i < ic_n; i++)
+		lend[i] = -1;
+	for (i = 0; i < ic_n; i++)
+		if (ic[i].op & O_JXX && ic[i].a3 <= i && lend[ic[i].a3] < i)
+			lend[ic[i].a3] = i;
+	/*
+	 * Overlapping [head, latch) ranges of the loops starting after
+	 * each value are merged on a stack, ordered by their heads; a
+	 * value used in a merged range should survive until its end.
+	 */
+	for (i = ic_n - 1; i >= 0; --i) {
+		if (i + 1 < ic_n && lend[i + 1] > i + 1) {
+			long e = lend[i + 1];
+			for (; top > 0 && beg[top - 1] <= e; top--)
+				e = MAX(e, end[top - 1]);
+			beg[top] = i + 1;
+			end[top++] = e;
+		}
+		if (top > 0 && luse[i] >= beg[top - 1]) {
+			long lo = 0, hi = top - 1;
+			while (lo < hi) {
+				long mid = (lo + hi) / 2;
+				if (beg[mid] <= luse[i])
+					hi = mid;
+				else
+					lo = mid + 1;
+			}
+			if (luse[i] < end[lo])
+				luse[i] = end[lo];
+		}
+	}
+	free(lend);
+	free(beg);
+	free(end);
 	return luse;
 }
 
+/* basic blocks of the intermediate code */
+static long *bb_beg;		/* the first instruction of each block */
+static long *bb_blk;		/* the block of each instruction */
+static long bb_n;		/* number of basic blocks */
+static long *bb_phead;		/* lists of predecessors of each block */
+static long *bb_pnext;		/* next entries in bb_phead[] lists */
+static long *bb_psrc;		/* the source block of bb_phead[] entries */
+static long *bb_po;		/* postorder number of each block */
+static long *bb_idom;		/* immediate dominator of each block */
+static long *bb_rpo;		/* blocks in reverse postorder */
+static long bb_rpo_n;		/* number of reachable blocks */
+static long *bb_dpre;		/* preorder number in the dominator tree */
+static long *bb_dpost;		/* postorder number in the dominator tree */
+
+static void bb_pred(long dst, long src, long *n)
+{
+	bb_psrc[*n] = src;
+	bb_pnext[*n] = bb_phead[dst];
+	bb_phead[dst] = (*n)++;
+}
+
+/* number the blocks in postorder */
+static void bb_dfs(struct ic *ic, long ic_n, long b, long *cnt)
+{
+	long last = (b + 1 < bb_n ? bb_beg[b + 1] : ic_n) - 1;
+	long op = ic[last].op;
+	bb_po[b] = 0;
+	if (op & O_JXX && bb_po[bb_blk[ic[last].a3]] < 0)
+		bb_dfs(ic, ic_n, bb_blk[ic[last].a3], cnt);
+	if (!(op & (O_JMP | O_RET)) && last + 1 < ic_n &&
+			bb_po[bb_blk[last + 1]] < 0)
+		bb_dfs(ic, ic_n, bb_blk[last + 1], cnt);
+	bb_po[b] = ++*cnt;
+	bb_rpo[bb_n - *cnt] = b;
+}
+
+static long bb_intersect(long b1, long b2)
+{
+	while (b1 != b2) {
+		while (bb_po[b1] < bb_po[b2])
+			b1 = bb_idom[b1];
+		while (bb_po[b2] < bb_po[b1])
+			b2 = bb_idom[b2];
+	}
+	return b1;
+}
+
+/* return nonzero if block b1 dominates block b2 */
+static int bb_dominates(long b1, long b2)
+{
+	if (b1 == b2)
+		return 1;
+	if (bb_dpre[b1] < 0 || bb_dpre[b2] < 0)
+		return 0;
+	return bb_dpre[b1] < bb_dpre[b2] && bb_dpost[b2] < bb_dpost[b1];
+}
+
+/* number the dominator tree; b1 dominates b2 if its range includes b2's */
+static void bb_domnum(void)
+{
+	long *head = malloc(bb_n * sizeof(head[0]));
+	long *next = malloc(bb_n * sizeof(next[0]));
+	long *stk = malloc(bb_n * sizeof(stk[0]));
+	long root = bb_rpo[bb_n - bb_rpo_n];
+	long stk_n = 0, n = 0;
+	long b, c;
+	for (b = 0; b < bb_n; b++) {
+		head[b] = -1;
+		bb_dpre[b] = -1;
+		bb_dpost[b] = -1;
+	}
+	for (b = 0; b < bb_n; b++) {
+		if (b != root && bb_idom[b] >= 0) {
+			next[b] = head[bb_idom[b]];
+			head[bb_idom[b]] = b;
+		}
+	}
+	bb_dpre[root] = n++;
+	stk[stk_n++] = root;
+	while (stk_n > 0) {
+		b = stk[stk_n - 1];
+		if ((c = head[b]) >= 0) {
+			head[b] = next[c];
+			bb_dpre[c] = n++;
+			stk[stk_n++] = c;
+		} else {
+			bb_dpost[b] = n++;
+			stk_n--;
+		}
+	}
+	free(head);
+	free(next);
+	free(stk);
+}
+
+/* compute the dominator tree of the basic blocks */
+static void bb_doms(void)
+{
+	int changed = 1;
+	long i, p;
+	for (i = 0; i < bb_n; i++)
+		bb_idom[i] = -1;
+	bb_idom[bb_rpo[bb_n - bb_rpo_n]] = bb_rpo[bb_n - bb_rpo_n];
+	while (changed) {
+		changed = 0;
+		for (i = bb_n - bb_rpo_n + 1; i < bb_n; i++) {
+			long b = bb_rpo[i];
+			long idom = -1;
+			for (p = bb_phead[b]; p >= 0; p = bb_pnext[p]) {
+				long src = bb_psrc[p];
+				if (bb_idom[src] < 0)
+					continue;
+				idom = idom < 0 ? src : bb_intersect(src, idom);
+			}
+			if (bb_idom[b] != idom) {
+				bb_idom[b] = idom;
+				changed = 1;
+			}
+		}
+	}
+}
+
+/* find basic blocks, their predecessors and dominators */
+static void bb_init(struct ic *ic, long ic_n)
+{
+	char *dst = calloc(ic_n, sizeof(dst[0]));
+	long pred_n = 0;
+	long i;
+	for (i = 0; i < ic_n; i++)
+		if (ic[i].op & O_JXX)
+			dst[ic[i].a3] = 1;
+	bb_beg = malloc(ic_n * sizeof(bb_beg[0]));
+	bb_blk = malloc(ic_n * sizeof(bb_blk[0]));
+	bb_n = 0;
+	for (i = 0; i < ic_n; i++) {
+		if (!i || dst[i] || ic[i - 1].op & (O_JXX | O_RET))
+			bb_beg[bb_n++] = i;
+		bb_blk[i] = bb_n - 1;
+	}
+	bb_phead = malloc(bb_n * sizeof(bb_phead[0]));
+	bb_pnext = malloc((ic_n + bb_n) * sizeof(bb_pnext[0]));
+	bb_psrc = malloc((ic_n + bb_n) * sizeof(bb_psrc[0]));
+	bb_po = malloc(bb_n * sizeof(bb_po[0]));
+	bb_idom = malloc(bb_n * sizeof(bb_idom[0]));
+	bb_rpo = malloc(bb_n * sizeof(bb_rpo[0]));
+	bb_dpre = malloc(bb_n * sizeof(bb_dpre[0]));
+	bb_dpost = malloc(bb_n * sizeof(bb_dpost[0]));
+	for (i = 0; i < bb_n; i++) {
+		long beg = bb_beg[i];
+		bb_phead[i] = -1;
+		bb_po[i] = -1;
+		if (beg > 0 && !(ic[beg - 1].op & (O_JMP | O_RET)))
+			bb_pred(i, bb_blk[beg - 1], &pred_n);
+	}
+	for (i = 0; i < ic_n; i++)
+		if (ic[i].op & O_JXX)
+			bb_pred(bb_blk[ic[i].a3], bb_blk[i], &pred_n);
+	bb_rpo_n = 0;
+	if (bb_n)
+		bb_dfs(ic, ic_n, 0, &bb_rpo_n);
+	if (bb_n)
+		bb_doms();
+	if (bb_n)
+		bb_domnum();
+	free(dst);
+}
+
+static void bb_done(void)
+{
+	free(bb_beg);
+	free(bb_blk);
+	free(bb_phead);
+	free(bb_pnext);
+	free(bb_psrc);
+	free(bb_po);
+	free(bb_idom);
+	free(bb_rpo);
+	free(bb_dpre);
+	free(bb_dpost);
+}
+
+/*
+ * Mark the blocks of the natural loop with header h, store them in
+ * blks, and return their number.
+ */
+static long bb_loop(long h, long *mark, long *stk, long *blks)
+{
+	long stk_n = 0;
+	long cnt = 0;
+	long p;
+	for (p = bb_phead[h]; p >= 0; p = bb_pnext[p]) {
+		long src = bb_psrc[p];
+		if (bb_po[src] > 0 && bb_dominates(h, src))
+			stk[stk_n++] = src;
+	}
+	if (!stk_n)
+		return 0;
+	mark[h] = h;
+	blks[cnt++] = h;
+	while (stk_n > 0) {
+		long b = stk[--stk_n];
+		if (mark[b] == h)
+			continue;
+		mark[b] = h;
+		blks[cnt++] = b;
+		for (p = bb_phead[b]; p >= 0; p = bb_pnext[p])
+			if (bb_po[bb_psrc[p]] > 0 && mark[bb_psrc[p]] != h)
+				stk[stk_n++] = bb_psrc[p];
+	}
+	return cnt;
+}
+
+/*
+ * The returned array indicates the number of natural loops
+ * containing each instruction.
+ */
+long *ic_loopdepth(struct ic *ic, long ic_n)
+{
+	long *ret = malloc(ic_n * sizeof(ret[0]));
+	long *depth, *mark, *stk, *blks;
+	long i, b, cnt;
+	bb_init(ic, ic_n);
+	depth = calloc(bb_n, sizeof(depth[0]));
+	mark = malloc(bb_n * sizeof(mark[0]));
+	stk = malloc((ic_n + bb_n) * sizeof(stk[0]));
+	blks = malloc(bb_n * sizeof(blks[0]));
+	for (b = 0; b < bb_n; b++)
+		mark[b] = -1;
+	for (b = 0; b < bb_n; b++) {
+		cnt = bb_po[b] > 0 ? bb_loop(b, mark, stk, blks) : 0;
+		for (i = 0; i < cnt; i++)
+			depth[blks[i]]++;
+	}
+	for (i = 0; i < ic_n; i++)
+		ret[i] = depth[bb_blk[i]];
+	free(depth);
+	free(mark);
+	free(stk);
+	free(blks);
+	bb_done();
+	return ret;
+}
+
 /* intermediate code optimisations */
 
 /* constant folding */
@@ -627,6 +967,192 @@ static int io_mul2(void)
 	return 1;
 }
 
+#define DIVW		(LONGSZ * 8)	/* the width of division operands */
+#define DIVMASK		(~0ul >> (sizeof(long) * 8 - DIVW))
+
+/* sign-extend a DIVW-bit number */
+static long div_sx(unsigned long n)
+{
+	n &= DIVMASK;
+	return n & (1ul << (DIVW - 1)) ? (long) (n | ~DIVMASK) : (long) n;
+}
+
+/* the magic multiplier for signed division by d (Hacker's Delight 10-1) */
+static long div_smagic(long d, int *shift)
+{
+	unsigned long two = 1ul << (DIVW - 1);
+	unsigned long ad = (d < 0 ? -d : d) & DIVMASK;
+	unsigned long t = two + ((d & DIVMASK) >> (DIVW - 1));
+	unsigned long anc = t - 1 - t % ad;
+	unsigned long q1 = two / anc, r1 = two - q1 * anc;
+	unsigned long q2 = two / ad, r2 = two - q2 * ad;
+	unsigned long delta;
+	int p = DIVW - 1;
+	do {
+		p++;
+		q1 = (q1 * 2) & DIVMASK;
+		r1 = (r1 * 2) & DIVMASK;
+		if (r1 >= anc) {
+			q1++;
+			r1 -= anc;
+		}
+		q2 = (q2 * 2) & DIVMASK;
+		r2 = (r2 * 2) & DIVMASK;
+		if (r2 >= ad) {
+			q2++;
+			r2 -= ad;
+		}
+		delta = ad - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+	*shift = p - DIVW;
+	return d < 0 ? -div_sx(q2 + 1) : div_sx(q2 + 1);
+}
+
+/* the magic multiplier for unsigned division by d (Hacker's Delight 10-2) */
+static long div_umagic(unsigned long d, int *shift, int *add)
+{
+	unsigned long two = 1ul << (DIVW - 1);
+	unsigned long nc = DIVMASK - ((0 - d) & DIVMASK) % d;
+	unsigned long q1 = two / nc, r1 = two - q1 * nc;
+	unsigned long q2 = (two - 1) / d, r2 = (two - 1) - q2 * d;
+	unsigned long delta;
+	int p = DIVW - 1;
+	*add = 0;
+	do {
+		p++;
+		if (r1 >= nc - r1) {
+			q1 = (q1 * 2 + 1) & DIVMASK;
+			r1 = (r1 * 2 - nc) & DIVMASK;
+		} else {
+			q1 = (q1 * 2) & DIVMASK;
+			r1 = (r1 * 2) & DIVMASK;
+		}
+		if (r2 + 1 >= d - r2) {
+			if (q2 >= two - 1)
+				*add = 1;
+			q2 = (q2 * 2 + 1) & DIVMASK;
+			r2 = (r2 * 2 + 1 - d) & DIVMASK;
+		} else {
+			if (q2 >= two)
+				*add = 1;
+			q2 = (q2 * 2) & DIVMASK;
+			r2 = (r2 * 2 + 1) & DIVMASK;
+		}
+		delta = d - 1 - r2;
+	} while (p < DIVW * 2 && (q1 < delta || (q1 == delta && r1 == 0)));
+	*shift = p - DIVW;
+	return div_sx(q2 + 1);
+}
+
+/* push the quotient of signed division of x by d */
+static void div_signed(long x, long d)
+{
+	int p = log2a(d < 0 ? -d : d);
+	int s;
+	long m;
+	if (p == 0) {
+		iv_put(x);
+	} else if (p > 0) {	/* rounding towards zero */
+		iv_put(x);
+		o_num(DIVW - 1);
+		o_bop(O_MK(O_SHR, SLNG));
+		o_num(DIVW - p);
+		o_bop(O_MK(O_SHR, ULNG));
+		iv_put(x);
+		o_bop(O_MK(O_ADD, SLNG));
+		o_num(p);
+		o_bop(O_MK(O_SHR, SLNG));
+	} else {
+		m = div_smagic(d, &s);
+		iv_put(x);
+		o_num(m);
+		o_bop(O_MK(O_MULH, SLNG));
+		if (d > 0 && m < 0) {
+			iv_put(x);
+			o_bop(O_MK(O_ADD, SLNG));
+		}
+		if (d < 0 && m > 0) {
+			iv_put(x);
+			o_bop(O_MK(O_SUB, SLNG));
+		}
+		if (s) {
+			o_num(s);
+			o_bop(O_MK(O_SHR, SLNG));
+		}
+		iv_dup();		/* adding one to negative quotients */
+		o_num(DIVW - 1);
+		o_bop(O_MK(O_SHR, ULNG));
+		o_bop(O_MK(O_ADD, SLNG));
+		return;
+	}
+	if (d < 0)
+		o_uop(O_MK(O_NEG, SLNG));
+}
+
+/* push the quotient of unsigned division of x by d */
+static void div_unsigned(long x, unsigned long d)
+{
+	int s, add;
+	long m;
+	if (d & (1ul << (DIVW - 1))) {
+		iv_put(x);
+		o_num(d);
+		o_bop(O_MK(O_GE, ULNG));
+		return;
+	}
+	m = div_umagic(d, &s, &add);
+	iv_put(x);
+	o_num(m);
+	o_bop(O_MK(O_MULH, ULNG));
+	if (add) {		/* ((x - t) / 2 + t) >> (s - 1) */
+		iv_dup();
+		iv_put(x);
+		o_tmpswap();
+		o_bop(O_MK(O_SUB, ULNG));
+		o_num(1);
+		o_bop(O_MK(O_SHR, ULNG));
+		o_bop(O_MK(O_ADD, ULNG));
+		s--;
+	}
+	if (s) {
+		o_num(s);
+		o_bop(O_MK(O_SHR, ULNG));
+	}
+}
+
+/* division and remainder by constants using multiplication */
+static int io_div(void)
+{
+	long iv = iv_get(0);
+	long oc = O_C(ic[iv].op);
+	long bt = O_T(ic[iv].op);
+	long x = ic[iv].a1;
+	long m[5];
+	long d;
+	if ((oc != O_DIV && oc != O_MOD) || ic_num(ic, ic[iv].a2, &d))
+		return 1;
+	d = bt & T_MSIGN ? div_sx(d) : d & DIVMASK;
+	if (!d || (~bt & T_MSIGN && d == 1))
+		return 1;
+	if (bt & T_MSIGN && d == div_sx(1ul << (DIVW - 1)))
+		return 1;
+	if (i_reg(O_MK(O_MULH, bt), m + 0, m + 1, m + 2, m + 3, m + 4))
+		return 1;
+	iv_drop(1);
+	if (bt & T_MSIGN)
+		div_signed(x, d);
+	else
+		div_unsigned(x, d);
+	if (oc == O_MOD) {	/* x - x / d * d */
+		o_num(d);
+		o_bop(O_MK(O_MUL, bt));
+		iv_put(x);
+		o_tmpswap();
+		o_bop(O_MK(O_SUB, bt));
+	}
+	return 0;
+}
+
 /* optimise comparison */
 static int io_cmp(void)
 {
@@ -726,6 +1252,43 @@ static int io_loc(void)
 	return 1;
 }
 
+/*
+ * Unroll block copies and fills of short constant lengths (at most
+ * I_MEMMAX) into loads and stores of at most I_MEMWORD bytes.
+ */
+static int io_mem(long oc, long r0, long r1, long r2)
+{
+	long n, c = 0;
+	long off = 0;
+	long v;
+	int sz, i;
+	if (ic_num(ic, r2, &n) || n < 0 || n > I_MEMMAX)
+		return 1;
+	if (oc == O_MSET && ic_num(ic, r1, &c))
+		return 1;
+	for (sz = I_MEMWORD; sz > 0; sz >>= 1) {
+		long bt = T_MK(0, sz);
+		v = -1;
+		for (; off + sz <= n; off += sz) {
+			if (oc == O_MCPY) {
+				ic_put(O_MK(O_LD | O_NUM, bt), r1, off, 0);
+				io_loc();
+				v = iv_pop();
+			}
+			if (oc == O_MSET && v < 0) {
+				long w = 0;
+				for (i = 0; i < sz; i++)
+					w = (w << 8) | (c & 0xff);
+				o_num(w);
+				v = iv_pop();
+			}
+			ic_put(O_MK(O_ST | O_NUM, bt), v, r0, off);
+			io_loc();
+		}
+	}
+	return 0;
+}
+
 /* use instruction immediates */
 static int io_imm(void)
 {
@@ -776,6 +1339,119 @@ static int io_imm(void)
 	return 1;
 }
 
+/* the first instruction of the pure code computing instructions beg to end */
+static long ic_pure(long beg, long end)
+{
+	long i;
+	for (i = end; i >= beg; i--) {
+		int n = ic_regcnt(&ic[i]);
+		if (!(ic[i].op & (O_BOP | O_UOP | O_MOV | O_LD)))
+			return -1;
+		if (n >= 1 && ic[i].a1 < beg)
+			beg = ic[i].a1;
+		if (n >= 2 && ic[i].a2 < beg)
+			beg = ic[i].a2;
+	}
+	return beg;
+}
+
+/* return nonzero if ic[beg..end] loads the value loaded by ic[iv] */
+static int ic_ldshared(long beg, long end, long iv)
+{
+	long oc = O_C(ic[iv].op);
+	long i;
+	if (!(oc & O_LD) || !(oc & (O_LOC | O_SYM)))
+		return 0;
+	for (i = beg; i <= end; i++)
+		if (ic[i].op == ic[iv].op && ic[i].a1 == ic[iv].a1 &&
+				ic[i].a2 == ic[iv].a2)
+			return 1;
+	return 0;
+}
+
+/* the number of registers needed for computing ic[beg..end] (Sethi-Ullman) */
+static void ic_need(long beg, long end, long *need)
+{
+	long i;
+	for (i = beg; i <= end; i++) {
+		struct ic *c = &ic[i];
+		int n = ic_regcnt(c);
+		long n1 = n >= 1 && c->a1 >= beg ? need[c->a1 - beg] : 1;
+		long n2 = n >= 2 && c->a2 >= beg ? need[c->a2 - beg] : 1;
+		if (n >= 2 && c->a1 < c->a2)
+			need[i - beg] = MAX(n1, n2 + 1);
+		else if (n >= 2)
+			need[i - beg] = MAX(n2, n1 + 1);
+		else
+			need[i - beg] = n1;
+	}
+}
+
+static long *ord_pos;		/* register needs and new positions in io_order() */
+static struct ic *ord_old;	/* instructions moved by io_order() */
+static long ord_sz;		/* the size of ord_pos[] and ord_old[] */
+
+/*
+ * Compute the right operand of a binary operation first, if both
+ * operands are side-effect free and the right one needs more registers.
+ */
+static int io_order(void)
+{
+	long end = ic_n - 1;
+	long r1, r2, beg, *pos;
+	struct ic *old;
+	long i, nl, nr;
+	if (iv_n < 2)
+		return 1;
+	r1 = iv_get(0);
+	r2 = iv_get(1);
+	if (r2 >= r1 || ic_const(r1) || ic_const(r2))
+		return 1;
+	if (ic_pure(r2 + 1, end) != r2 + 1)
+		return 1;
+	beg = ic_pure(r2, r2);
+	if (beg < lab_last)
+		return 1;
+	for (i = 2; i < iv_n; i++)
+		if (iv_get(i) >= beg)
+			return 1;
+	/* operands sharing loads may be merged later; ordering does not matter */
+	for (i = r2 + 1; i <= end; i++)
+		if (ic_ldshared(beg, r2, i))
+			return 1;
+	if (end - beg + 1 > ord_sz) {
+		long sz = MAX(128, MAX(ord_sz * 2, end - beg + 1));
+		ord_pos = mextend(ord_pos, ord_sz, sz, sizeof(ord_pos[0]));
+		ord_old = mextend(ord_old, ord_sz, sz, sizeof(ord_old[0]));
+		ord_sz = sz;
+	}
+	pos = ord_pos;
+	old = ord_old;
+	ic_need(beg, end, pos);
+	nl = pos[r2 - beg];
+	nr = pos[r1 - beg];
+	if (nr <= nl)
+		return 1;
+	/* moving ic[r2 + 1..end] before ic[beg..r2] */
+	memcpy(old, ic + beg, (end - beg + 1) * sizeof(old[0]));
+	for (i = beg; i <= end; i++)
+		pos[i - beg] = i <= r2 ? i + end - r2 : i - (r2 - beg + 1);
+	for (i = beg; i <= end; i++) {
+		struct ic *c = &ic[pos[i - beg]];
+		int n = ic_regcnt(&old[i - beg]);
+		*c = old[i - beg];
+		if (n >= 1 && c->a1 >= beg)
+			c->a1 = pos[c->a1 - beg];
+		if (n >= 2 && c->a2 >= beg)
+			c->a2 = pos[c->a2 - beg];
+	}
+	iv_drop(2);
+	iv_put(pos[r2 - beg]);
+	iv_put(pos[r1 - beg]);
+	ic_stat_order++;
+	return 0;
+}
+
 /* calling symbols */
 static int io_call(void)
 {
@@ -789,6 +1465,197 @@ static int io_call(void)
 	return 1;
 }
 
+/*
+ * Returning the result of a call: callers cast the returned value, so
+ * casting the result of the call is unnecessary if the called function
+ * returns the same type.  This exposes calls in tail position.
+ */
+static int io_retcall(int ret)
+{
+	long iv = iv_get(0);
+	long src = ic[iv].a1;
+	if (O_C(ic[iv].op) == O_MOV && ic[src].op & O_CALL &&
+			O_T(ic[iv].op) == ret) {
+		iv_drop(1);
+		iv_put(src);
+		return 0;
+	}
+	return 1;
+}
+
+/* the body of functions that may be inlined */
+struct inl {
+	long sym;		/* function symbol */
+	struct ic *ic;		/* intermediate code */
+	long ic_n;		/* number of instructions in ic[] */
+	long argc;		/* number of arguments */
+	long *loc;		/* the size of other locals */
+	long loc_n;		/* number of entries in loc[] */
+	long live;		/* maximum number of live values */
+};
+
+/* the maximum size of inlined functions */
+#define INLSZ		(opt(3) ? 64 : (opt(2) ? 32 : 8))
+
+static struct inl *inl;		/* functions that may be inlined */
+static long inl_n, inl_sz;	/* number of entries in inl[] */
+
+/* keep the intermediate code of small functions for inlining */
+void ic_inline(long sym, struct ic *ic, long ic_n,
+		long argc, long *loc_len, long loc_n)
+{
+	struct inl *f;
+	long *luse;
+	long i, j, n;
+	if (!opt(1) || ic_n > INLSZ)
+		return;
+	if (inl_n == inl_sz) {
+		inl_sz = MAX(16, inl_sz * 2);
+		inl = mextend(inl, inl_n, inl_sz, sizeof(inl[0]));
+	}
+	f = &inl[inl_n++];
+	f->sym = sym;
+	f->ic = malloc(ic_n * sizeof(f->ic[0]));
+	memcpy(f->ic, ic, ic_n * sizeof(f->ic[0]));
+	for (i = 0; i < ic_n; i++) {
+		if (ic[i].op & O_CALL) {
+			f->ic[i].args = malloc(ic[i].a3 * sizeof(ic[i].args[0]));
+			memcpy(f->ic[i].args, ic[i].args,
+				ic[i].a3 * sizeof(ic[i].args[0]));
+		}
+	}
+	f->ic_n = ic_n;
+	f->argc = argc;
+	f->loc = malloc(loc_n * sizeof(f->loc[0]));
+	memcpy(f->loc, loc_len, loc_n * sizeof(f->loc[0]));
+	f->loc_n = loc_n;
+	f->live = 0;
+	luse = ic_lastuse(ic, ic_n);
+	for (i = 0; i < ic_n; i++) {
+		for (n = 0, j = 0; j < i; j++)
+			if (luse[j] >= i)
+				n++;
+		f->live = MAX(f->live, n);
+	}
+	free(luse);
+}
+
+/* the type with which the given argument of an inlined function is accessed */
+static long inl_argbt(struct inl *f, long arg)
+{
+	long bt = 0;
+	long i;
+	for (i = 0; i < f->ic_n; i++) {
+		struct ic *c = &f->ic[i];
+		long oc = O_C(c->op);
+		if (oc == (O_MOV | O_LOC) && c->a1 == arg)
+			return ULNG;
+		if ((oc == (O_LD | O_LOC) && c->a1 == arg && !c->a2) ||
+				(oc == (O_ST | O_LOC) && c->a2 == arg && !c->a3)) {
+			if (bt && bt != O_T(c->op))
+				return ULNG;
+			bt = O_T(c->op);
+			continue;
+		}
+		if ((oc == (O_LD | O_LOC) && c->a1 == arg) ||
+				(oc == (O_ST | O_LOC) && c->a2 == arg))
+			return ULNG;
+	}
+	return bt ? bt : ULNG;
+}
+
+/*
+ * Inline the call to fn by copying the body of the function.  The
+ * arguments are stored in new locals and returns jump to the end of
+ * the inlined body.  Inlined jumps refer to instruction positions,
+ * encoded as negative label identifiers until ic_get().
+ */
+static int io_inline(long fn, long *args, int argc, int ret)
+{
+	struct inl *f = NULL;
+	long *loc, *pos;
+	long sym, off;
+	long res = -1, end;
+	long nret = 0;
+	long i, j;
+	if (ic_sym(ic, fn, &sym, &off) || off)
+		return 1;
+	for (i = 0; i < inl_n; i++)
+		if (inl[i].sym == sym)
+			f = &inl[i];
+	if (!f || f->argc != argc || iv_n + f->live >= NTMPS / 2)
+		return 1;
+	for (i = 0; i < f->ic_n; i++)
+		if (f->ic[i].op & O_RET)
+			nret++;
+	/* new locals for the arguments and locals of the function */
+	loc = malloc((argc + f->loc_n) * sizeof(loc[0]));
+	for (i = 0; i < argc; i++)
+		loc[i] = o_mklocal(ULNG);
+	for (i = 0; i < f->loc_n; i++)
+		loc[argc + i] = o_mklocal(f->loc[i]);
+	if (ret && nret > 1)
+		res = o_mklocal(ULNG);
+	for (i = 0; i < argc; i++)
+		ic_put(O_MK(O_ST | O_LOC, inl_argbt(f, i)), args[i], loc[i], 0);
+	/* the position of inlined instructions */
+	pos = malloc(f->ic_n * sizeof(pos[0]));
+	end = ic_n;
+	for (i = 0; i < f->ic_n; i++) {
+		pos[i] = end;
+		if (f->ic[i].op & O_RET)
+			end += (res >= 0) + (i + 1 < f->ic_n);
+		else
+			end++;
+	}
+	for (i = 0; i < f->ic_n; i++) {
+		struct ic *s = &f->ic[i];
+		struct ic *c;
+		long oc = O_C(s->op);
+		long a1 = s->a1, a2 = s->a2, a3 = s->a3;
+		int n = ic_regcnt(s);
+		if (s->op & O_RET) {
+			if (res >= 0)
+				ic_put(O_MK(O_ST | O_LOC, ULNG), pos[a1], res, 0);
+			if (i + 1 < f->ic_n)
+				ic_put(O_JMP, 0, 0, -end - 1);
+			if (ret && nret == 1)
+				res = pos[a1];
+			continue;
+		}
+		if (n >= 1)
+			a1 = pos[a1];
+		if (n >= 2)
+			a2 = pos[a2];
+		if (n >= 3)
+			a3 = pos[a3];
+		if (s->op & O_JXX)
+			a3 = -pos[a3] - 1;
+		if (s->op & O_JXX && -a3 - 1 > lab_last)
+			lab_last = -a3 - 1;
+		if (oc == (O_LD | O_LOC) || oc == (O_MOV | O_LOC))
+			a1 = loc[a1];
+		if (oc == (O_ST | O_LOC))
+			a2 = loc[a2];
+		c = ic_put(s->op, a1, a2, a3);
+		if (s->op & O_OUT)
+			iv_drop(1);
+		if (s->op & O_CALL) {
+			c->args = malloc(s->a3 * sizeof(c->args[0]));
+			for (j = 0; j < s->a3; j++)
+				c->args[j] = pos[s->args[j]];
+		}
+	}
+	if (ret && nret > 1)
+		ic_put(O_MK(O_LD | O_LOC, ULNG), res, 0, 0);
+	if (ret && nret == 1)
+		iv_put(res);
+	free(loc);
+	free(pos);
+	ic_stat_inline++;
+	return 0;
+}
+
 /* remove dead code */
 static void io_deadcode(void)
 {
@@ -848,3 +1715,1195 @@ static void io_deadcode(void)
 	free(live);
 	free(nidx);
 }
+
+/* value numbering hash table entries */
+struct vn {
+	long op, a1, a2;	/* the operation and its value numbered arguments */
+	long mem;		/* memory state for loads */
+	long iv;		/* the instruction computing the value */
+	long next;		/* the next entry in the same vn_tab[] bucket */
+	long hash;		/* vn_tab[] bucket */
+};
+
+#define VNSZ		(1 << 10)
+#define VNCROSS		(NTMPS / 4)	/* values shared among blocks */
+
+static struct vn *vn;		/* value numbering entries */
+static long vn_n;		/* number of entries in vn[] */
+static long vn_tab[VNSZ];	/* the heads of vn[] hash buckets */
+static long *vn_num;		/* the value number of each instruction */
+static long *vn_rep;		/* the replacement of each instruction */
+static long vn_mem;		/* the current memory state */
+static long vn_memcnt;		/* number of memory states */
+static long vn_cross;		/* number of values shared among blocks */
+static long *vn_chead;		/* dominator tree children lists */
+static long *vn_cnext;		/* next entries in vn_chead[] lists */
+
+/* instructions whose result depends only on their arguments */
+static int vn_pure(long op)
+{
+	long oc = O_C(op);
+	if (oc & (O_BOP | O_UOP | O_MOV))
+		return 1;
+	return oc == (O_LD | O_NUM) || oc == (O_LD | O_LOC);
+}
+
+/* instructions that are numbered but not shared: constants and locals */
+static int vn_cheap(long op)
+{
+	long oc = O_C(op);
+	return (oc & O_MOV && oc & (O_NUM | O_SYM | O_LOC)) ||
+		oc == (O_LD | O_LOC);
+}
+
+static int vn_commutative(long op)
+{
+	long oc = O_C(op);
+	return oc == O_ADD || oc == O_MUL || oc == O_AND || oc == O_OR ||
+		oc == O_XOR || oc == O_EQ || oc == O_NE;
+}
+
+/*
+ * Can instruction i use the value of instruction k from a dominating
+ * block?  The code generator keeps the values that live past the end
+ * of a basic block on the stack; this pays off only for expensive
+ * operations.  Moreover, value lifetimes are linear; k should be
+ * placed before i and loops containing k should not be entered
+ * anywhere except their headers.
+ */
+static int vn_cross_ok(long k, long i)
+{
+	long oc = O_C(ic[i].op);
+	long j;
+	if (k > i || vn_cross >= VNCROSS)
+		return 0;
+	if (!(oc & O_MUL))
+		return 0;
+	for (j = k + 1; j < ic_n; j++) {
+		long t = ic[j].a3;
+		if (ic[j].op & O_JXX && t <= k &&
+				!bb_dominates(bb_blk[t], bb_blk[k]))
+			return 0;
+	}
+	return 1;
+}
+
+/* value numbering of the instructions of block b and its dominatees */
+static void vn_blk(long b)
+{
+	long beg = bb_beg[b];
+	long end = b + 1 < bb_n ? bb_beg[b + 1] : ic_n;
+	long mark = vn_n;
+	long i, c;
+	vn_mem = ++vn_memcnt;
+	for (i = beg; i < end; i++) {
+		long op = ic[i].op;
+		long n = ic_regcnt(ic + i);
+		long a1 = n >= 1 ? vn_num[ic[i].a1] : ic[i].a1;
+		long a2 = n >= 2 ? vn_num[ic[i].a2] : ic[i].a2;
+		long mem = op & O_LD ? vn_mem : 0;
+		unsigned long h;
+		long e;
+		if (op & (O_ST | O_CALL | O_MEM))
+			vn_mem = ++vn_memcnt;
+		if (!vn_pure(op))
+			continue;
+		if (n == 2 && vn_commutative(op) && a1 > a2) {
+			long t = a1;
+			a1 = a2;
+			a2 = t;
+		}
+		h = ((unsigned long) op * 31 + (unsigned long) a1 * 17 +
+			(unsigned long) a2 * 7 + (unsigned long) mem) % VNSZ;
+		for (e = vn_tab[h]; e >= 0; e = vn[e].next)
+			if (vn[e].op == op && vn[e].a1 == a1 &&
+					vn[e].a2 == a2 && vn[e].mem == mem)
+				break;
+		if (e >= 0 && vn_cheap(op)) {
+			vn_num[i] = vn[e].iv;
+			continue;
+		}
+		if (e >= 0 && (bb_blk[vn[e].iv] == b || vn_cross_ok(vn[e].iv, i))) {
+			if (bb_blk[vn[e].iv] != b)
+				vn_cross++;
+			ic_stat_cse++;
+			vn_num[i] = vn[e].iv;
+			vn_rep[i] = vn[e].iv;
+			continue;
+		}
+		vn[vn_n].op = op;
+		vn[vn_n].a1 = a1;
+		vn[vn_n].a2 = a2;
+		vn[vn_n].mem = mem;
+		vn[vn_n].iv = i;
+		vn[vn_n].hash = h;
+		vn[vn_n].next = vn_tab[h];
+		vn_tab[h] = vn_n++;
+	}
+	for (c = vn_chead[b]; c >= 0; c = vn_cnext[c])
+		vn_blk(c);
+	while (vn_n > mark) {
+		vn_n--;
+		vn_tab[vn[vn_n].hash] = vn[vn_n].next;
+	}
+}
+
+/* global value numbering and common subexpression elimination */
+static void io_gvn(void)
+{
+	long i, j;
+	bb_init(ic, ic_n);
+	vn = malloc(ic_n * sizeof(vn[0]));
+	vn_num = malloc(ic_n * sizeof(vn_num[0]));
+	vn_rep = malloc(ic_n * sizeof(vn_rep[0]));
+	vn_chead = malloc(bb_n * sizeof(vn_chead[0]));
+	vn_cnext = malloc(bb_n * sizeof(vn_cnext[0]));
+	for (i = 0; i < VNSZ; i++)
+		vn_tab[i] = -1;
+	for (i = 0; i < ic_n; i++)
+		vn_num[i] = i;
+	for (i = 0; i < ic_n; i++)
+		vn_rep[i] = i;
+	for (i = 0; i < bb_n; i++)
+		vn_chead[i] = -1;
+	for (i = bb_n - 1; i > 0; i--) {
+		if (bb_po[i] > 0 && bb_idom[i] != i) {
+			vn_cnext[i] = vn_chead[bb_idom[i]];
+			vn_chead[bb_idom[i]] = i;
+		}
+	}
+	vn_n = 0;
+	vn_cross = 0;
+	if (bb_n)
+		vn_blk(0);
+	for (i = 0; i < ic_n; i++) {
+		int n = ic_regcnt(ic + i);
+		if (n >= 1)
+			ic[i].a1 = vn_rep[ic[i].a1];
+		if (n >= 2)
+			ic[i].a2 = vn_rep[ic[i].a2];
+		if (n >= 3)
+			ic[i].a3 = vn_rep[ic[i].a3];
+		if (ic[i].op & O_CALL)
+			for (j = 0; j < ic[i].a3; j++)
+				ic[i].args[j] = vn_rep[ic[i].args[j]];
+	}
+	free(vn);
+	free(vn_num);
+	free(vn_rep);
+	free(vn_chead);
+	free(vn_cnext);
+	bb_done();
+}
+
+/* loop optimisations */
+#define LICMCOST	3		/* the minimum cost of hoisted expressions */
+#define LICMMAX		(NTMPS / 4)	/* hoisted values in each function */
+#define IVMAX		2		/* new pointers in each loop */
+#define IVEXT		(1l << 16)	/* the largest offset in rewritten exit tests */
+
+static struct ic *lp_cl;	/* instructions inserted before loops */
+static long lp_cl_n, lp_cl_sz;	/* number of entries in lp_cl[] */
+static long *lp_beg, *lp_end;	/* lp_cl[] entries placed before each instruction */
+static char *lp_ent;		/* whether each jump enters a loop from outside */
+static long *lp_rep;		/* the replacement of each instruction */
+static long *lp_copy;		/* the copy of each instruction in lp_cl[] */
+static char *lp_inv;		/* whether each instruction is invariant */
+static long *lp_cost;		/* the cost of evaluating invariants */
+static long *lp_luse;		/* the last instruction using each value */
+static long *lp_mark;		/* the blocks of the current loop */
+static long *lp_stk;		/* the stack used for finding loops */
+static long *lp_blks;		/* the blocks of the current loop */
+static long lp_blks_n;		/* the number of entries in lp_blks[] */
+static long lp_last;		/* the instruction after the last block of the loop */
+static long *lp_inner;		/* the innermost loop containing each block */
+static long *lp_size;		/* the number of blocks of each loop */
+static char *lp_addr;		/* whether the address of a local is taken */
+static char *lp_lst;		/* whether the loop may change a local */
+static long lp_locn;		/* number of locals */
+static long lp_cnt;		/* number of hoisted values */
+
+/* the replacement of instruction operands (lp_cl[] entries are not replaced) */
+#define LPREP(x)	((x) < ic_n ? lp_rep[x] : (x))
+
+/* append an instruction to lp_cl[]; return its index after ic[] */
+static long lp_put(long op, long a1, long a2, long a3)
+{
+	if (lp_cl_n == lp_cl_sz) {
+		lp_cl_sz = MAX(128, lp_cl_sz * 2);
+		lp_cl = mextend(lp_cl, lp_cl_n, lp_cl_sz, sizeof(lp_cl[0]));
+	}
+	lp_cl[lp_cl_n].op = op;
+	lp_cl[lp_cl_n].a1 = a1;
+	lp_cl[lp_cl_n].a2 = a2;
+	lp_cl[lp_cl_n].a3 = a3;
+	lp_cl[lp_cl_n].args = NULL;
+	return ic_n + lp_cl_n++;
+}
+
+/* find the blocks of the loop with header h; return zero if unusable */
+static int lp_find(long h)
+{
+	long i;
+	for (i = 0; i < lp_blks_n; i++)
+		lp_mark[lp_blks[i]] = -1;
+	lp_blks_n = bb_loop(h, lp_mark, lp_stk, lp_blks);
+	lp_last = 0;
+	/* the header should be the first block of the loop */
+	for (i = 0; i < lp_blks_n; i++) {
+		long b = lp_blks[i];
+		if (bb_beg[b] < bb_beg[h])
+			return 0;
+		lp_last = MAX(lp_last, b + 1 < bb_n ? bb_beg[b + 1] : ic_n);
+	}
+	return 1;
+}
+
+/* find the locals the loop may change; return nonzero if it writes memory */
+static int lp_scan(long h)
+{
+	int wmem = 0;
+	long i;
+	memset(lp_lst, 0, lp_locn);
+	for (i = bb_beg[h]; i < lp_last; i++) {
+		long op = ic[i].op;
+		if (lp_mark[bb_blk[i]] != h)
+			continue;
+		if (op & (O_CALL | O_MEM) || O_C(op) == (O_ST | O_NUM))
+			wmem = 1;
+		if (O_C(op) == (O_ST | O_LOC))
+			lp_lst[ic[i].a2] = 1;
+	}
+	for (i = 0; i < lp_locn && wmem; i++)
+		if (lp_addr[i])
+			lp_lst[i] = 1;
+	return wmem;
+}
+
+/* mark the jumps entering the loop with header h from outside */
+static void lp_entries(long h)
+{
+	long p;
+	for (p = bb_phead[h]; p >= 0; p = bb_pnext[p]) {
+		long b = bb_psrc[p];
+		long last = (b + 1 < bb_n ? bb_beg[b + 1] : ic_n) - 1;
+		if (ic[last].op & O_JXX && ic[last].a3 == bb_beg[h] &&
+				lp_mark[b] != h)
+			lp_ent[last] = 1;
+	}
+}
+
+/* find natural loops and allocate the arrays of loop optimisations */
+static void lp_init(void)
+{
+	long i, j, b;
+	bb_init(ic, ic_n);
+	lp_locn = 0;
+	for (i = 0; i < ic_n; i++) {
+		long oc = O_C(ic[i].op);
+		if (oc == (O_LD | O_LOC) || oc == (O_MOV | O_LOC))
+			lp_locn = MAX(lp_locn, ic[i].a1 + 1);
+		if (oc == (O_ST | O_LOC))
+			lp_locn = MAX(lp_locn, ic[i].a2 + 1);
+	}
+	lp_addr = calloc(lp_locn + 1, sizeof(lp_addr[0]));
+	lp_lst = calloc(lp_locn + 1, sizeof(lp_lst[0]));
+	for (i = 0; i < ic_n; i++)
+		if (O_C(ic[i].op) == (O_MOV | O_LOC))
+			lp_addr[ic[i].a1] = 1;
+	lp_mark = malloc(bb_n * sizeof(lp_mark[0]));
+	lp_stk = malloc((ic_n + bb_n) * sizeof(lp_stk[0]));
+	lp_blks = malloc(bb_n * sizeof(lp_blks[0]));
+	lp_inner = malloc(bb_n * sizeof(lp_inner[0]));
+	lp_size = calloc(bb_n, sizeof(lp_size[0]));
+	lp_rep = malloc(ic_n * sizeof(lp_rep[0]));
+	lp_copy = malloc(ic_n * sizeof(lp_copy[0]));
+	lp_inv = calloc(ic_n, sizeof(lp_inv[0]));
+	lp_cost = calloc(ic_n, sizeof(lp_cost[0]));
+	lp_luse = calloc(ic_n, sizeof(lp_luse[0]));
+	lp_beg = calloc(ic_n, sizeof(lp_beg[0]));
+	lp_end = calloc(ic_n, sizeof(lp_end[0]));
+	lp_ent = calloc(ic_n, sizeof(lp_ent[0]));
+	lp_cl_n = 0;
+	for (i = 0; i < ic_n; i++) {
+		long n = ic_regcnt(ic + i);
+		if (n >= 1)
+			lp_luse[ic[i].a1] = i;
+		if (n >= 2)
+			lp_luse[ic[i].a2] = i;
+		if (n >= 3)
+			lp_luse[ic[i].a3] = i;
+		if (ic[i].op & O_CALL)
+			for (j = 0; j < ic[i].a3; j++)
+				lp_luse[ic[i].args[j]] = i;
+	}
+	for (i = 0; i < ic_n; i++)
+		lp_rep[i] = i;
+	for (i = 0; i < ic_n; i++)
+		lp_copy[i] = -1;
+	for (b = 0; b < bb_n; b++)
+		lp_inner[b] = -1;
+	for (b = 0; b < bb_n; b++)
+		lp_mark[b] = -1;
+	for (b = 0; b < bb_n; b++) {
+		lp_size[b] = bb_po[b] > 0 ? bb_loop(b, lp_mark, lp_stk, lp_blks) : 0;
+		for (i = 0; i < lp_size[b]; i++) {
+			long k = lp_blks[i];
+			if (lp_inner[k] < 0 || lp_size[b] < lp_size[lp_inner[k]])
+				lp_inner[k] = b;
+		}
+	}
+	for (b = 0; b < bb_n; b++)
+		lp_mark[b] = -1;
+	lp_blks_n = 0;
+}
+
+/* insert lp_cl[] entries before their instructions and free the arrays */
+static void lp_done(void)
+{
+	long n = lp_cl_n;
+	long *nidx;
+	struct ic *nic;
+	long i, j, k;
+	if (n) {
+		nidx = malloc((ic_n + n) * sizeof(nidx[0]));
+		nic = malloc((ic_n + n) * sizeof(nic[0]));
+		for (i = 0, j = 0; i < ic_n; i++) {
+			for (k = lp_beg[i]; k < lp_end[i]; k++)
+				nidx[ic_n + k] = j++;
+			nidx[i] = j++;
+		}
+		for (i = 0; i < ic_n; i++) {
+			struct ic *c = &nic[nidx[i]];
+			int cnt = ic_regcnt(ic + i);
+			for (k = lp_beg[i]; k < lp_end[i]; k++) {
+				struct ic *d = &nic[nidx[ic_n + k]];
+				int dcnt = ic_regcnt(lp_cl + k);
+				memcpy(d, &lp_cl[k], sizeof(*d));
+				if (dcnt >= 1)
+					d->a1 = nidx[d->a1];
+				if (dcnt >= 2)
+					d->a2 = nidx[d->a2];
+			}
+			memcpy(c, &ic[i], sizeof(*c));
+			if (cnt >= 1)
+				c->a1 = nidx[LPREP(c->a1)];
+			if (cnt >= 2)
+				c->a2 = nidx[LPREP(c->a2)];
+			if (cnt >= 3)
+				c->a3 = nidx[LPREP(c->a3)];
+			if (c->op & O_JXX && lp_ent[i] && lp_beg[c->a3] < lp_end[c->a3])
+				c->a3 = nidx[ic_n + lp_beg[c->a3]];
+			else if (c->op & O_JXX)
+				c->a3 = nidx[c->a3];
+			if (c->op & O_CALL)
+				for (j = 0; j < c->a3; j++)
+					c->args[j] = nidx[LPREP(c->args[j])];
+		}
+		free(ic);
+		ic = nic;
+		ic_n += n;
+		ic_sz = ic_n;
+		free(nidx);
+	}
+	free(lp_cl);
+	free(lp_rep);
+	free(lp_copy);
+	free(lp_inv);
+	free(lp_cost);
+	free(lp_luse);
+	free(lp_beg);
+	free(lp_end);
+	free(lp_ent);
+	free(lp_mark);
+	free(lp_stk);
+	free(lp_blks);
+	free(lp_inner);
+	free(lp_size);
+	free(lp_addr);
+	free(lp_lst);
+	lp_cl = NULL;
+	lp_cl_n = 0;
+	lp_cl_sz = 0;
+	bb_done();
+}
+
+/* the relative cost of computing an instruction in a loop */
+static long lp_opcost(long op)
+{
+	long oc = O_C(op);
+	if (oc & O_MOV && oc & (O_NUM | O_SYM | O_LOC))
+		return 0;
+	if (oc == O_DIV || oc == O_MOD)
+		return 8;
+	if (oc == O_MUL || oc == (O_LD | O_NUM))
+		return 2;
+	return 1;
+}
+
+/* copy invariant x and its invariant operands to lp_cl[] */
+static long lp_hoist(long x)
+{
+	long n = ic_regcnt(ic + x);
+	long a1 = ic[x].a1;
+	long a2 = ic[x].a2;
+	if (!lp_inv[x])
+		return lp_rep[x];
+	if (lp_copy[x] >= 0)
+		return lp_copy[x];
+	if (n >= 1)
+		a1 = lp_hoist(a1);
+	if (n >= 2)
+		a2 = lp_hoist(a2);
+	lp_copy[x] = lp_put(ic[x].op, a1, a2, ic[x].a3);
+	return lp_copy[x];
+}
+
+/* can instruction x be moved to the preheader of the loop starting at beg */
+static int lp_invariant(long x, long beg, int wmem, int safe)
+{
+	long oc = O_C(ic[x].op);
+	long n = ic_regcnt(ic + x);
+	if (!vn_pure(ic[x].op))
+		return 0;
+	if (oc == (O_LD | O_LOC))
+		return !lp_lst[ic[x].a1];
+	if (oc == (O_LD | O_NUM) && (wmem || !safe))
+		return 0;
+	if ((oc == O_DIV || oc == O_MOD) && !safe)
+		return 0;
+	if (n >= 1 && !lp_inv[ic[x].a1] && ic[x].a1 >= beg)
+		return 0;
+	if (n >= 2 && !lp_inv[ic[x].a2] && ic[x].a2 >= beg)
+		return 0;
+	return 1;
+}
+
+/* hoist the invariants of the natural loop with header h */
+static void lp_loop(long h)
+{
+	long beg = bb_beg[h];
+	long *ex = lp_stk;
+	long ex_n = 0;
+	long uend;
+	int wmem;
+	long b, i, j;
+	if (!lp_find(h) || lp_beg[beg] < lp_end[beg])
+		return;
+	wmem = lp_scan(h);
+	uend = lp_last;
+	/* blocks leaving the loop */
+	for (b = h; b < bb_n && bb_beg[b] < lp_last; b++) {
+		long last = (b + 1 < bb_n ? bb_beg[b + 1] : ic_n) - 1;
+		long op = ic[last].op;
+		if (lp_mark[b] != h)
+			continue;
+		if (op & O_RET || (op & O_JXX && lp_mark[bb_blk[ic[last].a3]] != h) ||
+				(!(op & (O_JMP | O_RET)) && lp_mark[b + 1] != h))
+			ex[ex_n++] = b;
+	}
+	/* finding invariants */
+	for (i = beg; i < lp_last; i++) {
+		long n = ic_regcnt(ic + i);
+		int safe = ex_n > 0;
+		if (lp_inner[bb_blk[i]] != h)
+			continue;
+		for (j = 0; j < ex_n; j++)
+			if (!bb_dominates(bb_blk[i], ex[j]))
+				safe = 0;
+		lp_inv[i] = lp_invariant(i, beg, wmem, safe);
+		lp_cost[i] = lp_opcost(ic[i].op);
+		if (n >= 1 && lp_inv[ic[i].a1])
+			lp_cost[i] += lp_cost[ic[i].a1];
+		if (n >= 2 && lp_inv[ic[i].a2])
+			lp_cost[i] += lp_cost[ic[i].a2];
+		if (lp_inv[i])
+			uend = MAX(uend, lp_luse[i] + 1);
+	}
+	/* hoisting invariants used by other instructions */
+	lp_beg[beg] = lp_cl_n;
+	for (i = beg; i < uend; i++) {
+		long n = ic_regcnt(ic + i);
+		long args[3];
+		if (lp_inv[i])
+			continue;
+		args[0] = ic[i].a1;
+		args[1] = ic[i].a2;
+		args[2] = ic[i].a3;
+		for (j = 0; j < n + (ic[i].op & O_CALL ? ic[i].a3 : 0); j++) {
+			long x = j < n ? args[j] : ic[i].args[j - n];
+			if (lp_inv[x] && lp_rep[x] == x &&
+					lp_cost[x] >= LICMCOST && lp_cnt < LICMMAX) {
+				lp_rep[x] = lp_hoist(x);
+				lp_cnt++;
+			}
+		}
+	}
+	lp_end[beg] = lp_cl_n;
+	lp_entries(h);
+	for (i = beg; i < lp_last; i++) {
+		lp_inv[i] = 0;
+		lp_copy[i] = -1;
+	}
+}
+
+/* move loop invariants to loop preheaders; return nonzero if any */
+static int io_licm_pass(void)
+{
+	long b, n;
+	lp_init();
+	for (b = 0; b < bb_n; b++)
+		if (lp_size[b])
+			lp_loop(b);
+	n = lp_cl_n;
+	lp_done();
+	return n > 0;
+}
+
+/* loop-invariant code motion; each pass moves invariants out of one loop level */
+static void io_licm(void)
+{
+	int i;
+	lp_cnt = 0;
+	for (i = 0; i < 4 && io_licm_pass(); i++)
+		;
+	ic_stat_licm += lp_cnt;
+}
+
+/* array addresses indexed by induction variables */
+struct ivp {
+	long loc;		/* the induction variable */
+	long cast;		/* the cast applied to the variable or zero */
+	long size;		/* the element size */
+	long base;		/* the array address */
+	long ptr;		/* the local holding the address of the element */
+	long st;		/* the instruction updating the variable */
+	long step;		/* the amount added to the variable */
+};
+
+static long *iv_grp;		/* the ivp[] entry of each address */
+
+/* extract x * size; return nonzero if x is not multiplied */
+static int iv_scale(long x, long *idx, long *size)
+{
+	long oc = O_C(ic[x].op);
+	long n;
+	*idx = x;
+	*size = 1;
+	if (oc == (O_SHL | O_NUM) || (oc == O_SHL && !ic_num(ic, ic[x].a2, &n))) {
+		*idx = ic[x].a1;
+		*size = 1l << (oc & O_NUM ? ic[x].a2 : n);
+		return 0;
+	}
+	if (oc == (O_MUL | O_NUM) || (oc == O_MUL && !ic_num(ic, ic[x].a2, &n))) {
+		*idx = ic[x].a1;
+		*size = oc & O_NUM ? ic[x].a2 : n;
+		return 0;
+	}
+	if (oc == O_MUL && !ic_num(ic, ic[x].a1, &n)) {
+		*idx = ic[x].a2;
+		*size = n;
+		return 0;
+	}
+	return 1;
+}
+
+/* return the local loaded by x or -1; set *cast to the applied cast */
+static long iv_local(long x, long *ld, long *cast)
+{
+	*cast = 0;
+	if (O_C(ic[x].op) == O_MOV && T_SZ(O_T(ic[x].op)) == ULNG) {
+		*cast = x;
+		x = ic[x].a1;
+	}
+	*ld = x;
+	if (O_C(ic[x].op) != (O_LD | O_LOC) || ic[x].a2)
+		return -1;
+	/* unsigned variables may wrap around */
+	if (!(O_T(ic[x].op) & T_MSIGN) && T_SZ(O_T(ic[x].op)) != ULNG)
+		return -1;
+	return ic[x].a1;
+}
+
+/* is x a loop-invariant address that can be computed in the preheader */
+static int iv_inv(long x, long beg)
+{
+	long oc = O_C(ic[x].op);
+	if (x < beg)
+		return 1;
+	if (oc & O_MOV && oc & (O_NUM | O_SYM | O_LOC))
+		return 1;
+	return oc == (O_LD | O_LOC) && !lp_lst[ic[x].a1];
+}
+
+static int iv_same(long x, long y, long beg)
+{
+	if (!x || !y || x < beg || y < beg)
+		return x == y;
+	return ic[x].op == ic[y].op && ic[x].a1 == ic[y].a1 &&
+		ic[x].a2 == ic[y].a2;
+}
+
+/* copy invariant x to the preheader */
+static long iv_copy(long x, long beg)
+{
+	if (x < beg)
+		return x;
+	return lp_put(ic[x].op, ic[x].a1, ic[x].a2, ic[x].a3);
+}
+
+/* append x * size to lp_cl[] */
+static long iv_mul(long x, long size)
+{
+	long op = O_MK(O_MUL, ULNG);
+	long n = size;
+	if (size == 1)
+		return x;
+	if (log2a(size) > 0) {
+		op = O_MK(O_SHL, ULNG);
+		n = log2a(size);
+	}
+	if (imm_ok(op, n, 2))
+		return lp_put(op | O_NUM, x, n, 0);
+	return lp_put(op, x, lp_put(O_MOV | O_NUM, n, 0, 0), 0);
+}
+
+/* find the variable updated by adding a constant once in each iteration */
+static int iv_var(long h, long loc, long *st, long *step)
+{
+	long i, s = -1;
+	long val, b, p;
+	if (lp_addr[loc])
+		return 1;
+	for (i = bb_beg[h]; i < lp_last; i++) {
+		if (lp_mark[bb_blk[i]] == h && O_C(ic[i].op) == (O_ST | O_LOC) &&
+				ic[i].a2 == loc) {
+			if (s >= 0)
+				return 1;
+			s = i;
+		}
+	}
+	if (s < 0 || ic[s].a3 || lp_inner[bb_blk[s]] != h)
+		return 1;
+	if (!(O_T(ic[s].op) & T_MSIGN) && T_SZ(O_T(ic[s].op)) != ULNG)
+		return 1;
+	val = ic[s].a1;
+	if (O_C(ic[val].op) != (O_ADD | O_NUM) && O_C(ic[val].op) != (O_SUB | O_NUM))
+		return 1;
+	if (O_C(ic[ic[val].a1].op) != (O_LD | O_LOC) ||
+			ic[ic[val].a1].a1 != loc || ic[ic[val].a1].a2)
+		return 1;
+	/* the update should be performed in every iteration */
+	for (p = bb_phead[h]; p >= 0; p = bb_pnext[p]) {
+		b = bb_psrc[p];
+		if (lp_mark[b] == h && !bb_dominates(bb_blk[s], b))
+			return 1;
+	}
+	*st = s;
+	*step = O_C(ic[val].op) == (O_ADD | O_NUM) ? ic[val].a2 : -ic[val].a2;
+	return 0;
+}
+
+/*
+ * Can the induction variable be removed, if the exit test of the
+ * loop is changed to use the new pointer?  The variable should not
+ * be read elsewhere and the preheader, which reads the variable,
+ * should not be executed again after the loop, unless the variable
+ * is initialized just before it.
+ */
+static int iv_dead(long h, long loc, long st, long jcc)
+{
+	char *live;
+	long beg = bb_beg[h];
+	long i, j, q;
+	int ret = 1;
+	for (q = beg - 1; q >= 0 && !(ic[q].op & (O_JXX | O_RET)); q--)
+		if (O_C(ic[q].op) == (O_ST | O_LOC) && ic[q].a2 == loc)
+			break;
+	if (q >= 0 && ic[q].op & (O_JXX | O_RET))
+		q = -1;
+	for (i = 0; i < ic_n; i++) {
+		long dst = ic[i].a3;
+		if (!(ic[i].op & O_JXX))
+			continue;
+		if (dst == beg && lp_mark[bb_blk[i]] != h)
+			return 0;
+		if (q >= 0 && dst > q && dst < beg)
+			return 0;
+		if (q < 0 && i >= beg && dst < beg)
+			return 0;
+	}
+	/* the operands of instructions may refer to lp_cl[] entries */
+	live = calloc(ic_n + lp_cl_n, sizeof(live[0]));
+	for (i = ic_n - 1; i >= 0; i--) {
+		int n = ic_regcnt(ic + i);
+		if ((!(ic[i].op & O_OUT) || ic[i].op & O_CALL) && i != st)
+			live[i] = 1;
+		if (!live[i])
+			continue;
+		if (O_C(ic[i].op) == (O_LD | O_LOC) && ic[i].a1 == loc)
+			ret = 0;
+		if (n >= 1 && i != jcc)
+			live[ic[i].a1] = 1;
+		if (n >= 2)
+			live[ic[i].a2] = 1;
+		if (n >= 3)
+			live[ic[i].a3] = 1;
+		if (ic[i].op & O_CALL)
+			for (j = 0; j < ic[i].a3; j++)
+				live[ic[i].args[j]] = 1;
+	}
+	free(live);
+	return ret;
+}
+
+/* the constant stored in loc just before the loop starting at beg */
+static int iv_init(long beg, long loc, long *n)
+{
+	long q;
+	for (q = beg - 1; q >= 0 && !(ic[q].op & (O_JXX | O_RET)); q--)
+		if (O_C(ic[q].op) == (O_ST | O_LOC) && ic[q].a2 == loc)
+			return ic[q].a3 || ic_num(ic, ic[q].a1, n);
+	return 1;
+}
+
+/* can base + n * size not wrap around for a valid base */
+static int iv_near(long n, long size, int sign)
+{
+	if (!sign && n < 0)
+		return 0;
+	return n >= -IVEXT / size && n <= IVEXT / size;
+}
+
+/*
+ * Replace the exit test of the loop with a comparison of p->ptr.
+ * Both the initial value of the variable and the bound should be
+ * small constants; otherwise, the pointers may wrap around.
+ */
+static void iv_exit(long h, struct ivp *p)
+{
+	long beg = bb_beg[h];
+	long i, ld, cast, bound, init, n;
+	for (i = beg; i < lp_last; i++) {
+		long oc = O_C(ic[i].op);
+		int sign = O_T(ic[i].op) & T_MSIGN;
+		if (lp_mark[bb_blk[i]] != h || !(oc & O_JCC))
+			continue;
+		if (iv_local(ic[i].a1, &ld, &cast) != p->loc || cast != p->cast)
+			continue;
+		if (oc & O_NUM)
+			n = ic[i].a2;
+		else if (ic_num(ic, ic[i].a2, &n))
+			continue;
+		if (iv_init(beg, p->loc, &init) || !iv_near(init, p->size, sign) ||
+				!iv_near(n, p->size, sign))
+			continue;
+		if (!iv_dead(h, p->loc, p->st, i))
+			continue;
+		bound = lp_put(O_MOV | O_NUM, n * p->size, 0, 0);
+		bound = lp_put(O_MK(O_ADD, ULNG), p->base, bound, 0);
+		ic[i].op = O_MK(O_C(ic[i].op) & ~O_NUM,
+			T_MK(O_T(ic[i].op), ULNG));
+		ic[i].a2 = bound;
+		ic[ic[i].a1].op = O_MK(O_LD | O_LOC, ULNG);
+		ic[ic[i].a1].a1 = p->ptr;
+		ic[ic[i].a1].a2 = 0;
+		/* removing the update of the induction variable */
+		ic[p->st].op = O_MOV | O_NUM;
+		ic[p->st].a1 = 0;
+		ic[p->st].a2 = 0;
+		ic[p->st].a3 = 0;
+		ic_stat_ivdead++;
+		return;
+	}
+}
+
+/* replace array indexing with pointers in the loop with header h */
+static void iv_loop(long h)
+{
+	struct ivp ivp[IVMAX];
+	long beg = bb_beg[h];
+	long ivp_n = 0;
+	long i, j;
+	if (!lp_find(h) || lp_beg[beg] < lp_end[beg])
+		return;
+	lp_scan(h);
+	/* finding base + var * size expressions */
+	for (i = beg; i < lp_last; i++) {
+		long oc = O_C(ic[i].op);
+		long base, idx, size, ld, cast, loc, st, step;
+		if (lp_mark[bb_blk[i]] != h || oc != O_ADD)
+			continue;
+		for (j = 0; j < 2; j++) {
+			base = j ? ic[i].a2 : ic[i].a1;
+			iv_scale(j ? ic[i].a1 : ic[i].a2, &idx, &size);
+			loc = iv_local(idx, &ld, &cast);
+			if (loc >= 0 && size > 0 && iv_inv(base, beg))
+				break;
+		}
+		if (j == 2 || iv_var(h, loc, &st, &step))
+			continue;
+		/* the variable should not change between ld and i */
+		if (bb_blk[ld] != bb_blk[i] || (ld < st && st < i))
+			continue;
+		if (lp_beg[st + 1] < lp_end[st + 1])
+			continue;
+		for (j = 0; j < ivp_n; j++)
+			if (ivp[j].loc == loc && ivp[j].size == size &&
+					iv_same(ivp[j].cast, cast, beg) &&
+					iv_same(ivp[j].base, base, beg))
+				break;
+		if (j == ivp_n && ivp_n < IVMAX) {
+			ivp[j].loc = loc;
+			ivp[j].cast = cast;
+			ivp[j].size = size;
+			ivp[j].base = base;
+			ivp[j].st = st;
+			ivp[j].step = step;
+			ivp_n++;
+		}
+		iv_grp[i] = j < ivp_n ? j : -1;
+	}
+	if (!ivp_n)
+		return;
+	/* initializing the pointers in the preheader */
+	lp_beg[beg] = lp_cl_n;
+	for (j = 0; j < ivp_n; j++) {
+		struct ivp *p = &ivp[j];
+		long x = lp_put(O_MK(O_LD | O_LOC, O_T(ic[p->st].op)), p->loc, 0, 0);
+		if (p->cast)
+			x = lp_put(ic[p->cast].op, x, 0, 0);
+		p->base = iv_copy(p->base, beg);
+		p->ptr = o_mklocal(ULNG);
+		x = lp_put(O_MK(O_ADD, ULNG), p->base, iv_mul(x, p->size), 0);
+		lp_put(O_MK(O_ST | O_LOC, ULNG), x, p->ptr, 0);
+	}
+	/* loading the pointers instead of computing the addresses */
+	for (i = beg; i < lp_last; i++) {
+		if (lp_mark[bb_blk[i]] == h && iv_grp[i] >= 0) {
+			ic[i].op = O_MK(O_LD | O_LOC, ULNG);
+			ic[i].a1 = ivp[iv_grp[i]].ptr;
+			ic[i].a2 = 0;
+			ic_stat_ivsr++;
+		}
+	}
+	iv_exit(h, &ivp[0]);
+	lp_end[beg] = lp_cl_n;
+	lp_entries(h);
+	/* advancing the pointers after updating the variables */
+	for (i = 0; i < ivp_n; i++) {
+		long pos = ivp[i].st + 1;
+		if (lp_beg[pos] < lp_end[pos])
+			continue;
+		lp_beg[pos] = lp_cl_n;
+		for (j = i; j < ivp_n; j++) {
+			struct ivp *p = &ivp[j];
+			long step = p->step * p->size;
+			long x;
+			if (p->st + 1 != pos)
+				continue;
+			x = lp_put(O_MK(O_LD | O_LOC, ULNG), p->ptr, 0, 0);
+			if (imm_ok(O_MK(O_ADD, ULNG), step, 2))
+				x = lp_put(O_MK(O_ADD | O_NUM, ULNG), x, step, 0);
+			else
+				x = lp_put(O_MK(O_ADD, ULNG), x,
+					lp_put(O_MOV | O_NUM, step, 0, 0), 0);
+			lp_put(O_MK(O_ST | O_LOC, ULNG), x, p->ptr, 0);
+		}
+		lp_end[pos] = lp_cl_n;
+	}
+	for (i = beg; i < lp_last; i++)
+		iv_grp[i] = -1;
+}
+
+/* induction variable strength reduction */
+static void io_ivsr(void)
+{
+	long i, b;
+	lp_init();
+	iv_grp = malloc(ic_n * sizeof(iv_grp[0]));
+	for (i = 0; i < ic_n; i++)
+		iv_grp[i] = -1;
+	for (b = 0; b < bb_n; b++)
+		if (lp_size[b])
+			iv_loop(b);
+	free(iv_grp);
+	lp_done();
+}
+
+/* basic block layout */
+#define LYROT		8	/* the maximum size of duplicated loop headers */
+
+static long *ly_ord;		/* blocks in their new order */
+static long *ly_pos;		/* the position of each block in ly_ord[] */
+static char *ly_placed;		/* whether each block is placed */
+static long *ly_uses;		/* uses of the values of each block in placed blocks */
+static char *ly_ext;		/* whether the values of each block are used outside it */
+
+/* the number of value operands of an instruction */
+static long ic_opndcnt(struct ic *c)
+{
+	return ic_regcnt(c) + (c->op & O_CALL ? c->a3 : 0);
+}
+
+/* the j-th value operand of an instruction */
+static long ic_opnd(struct ic *c, long j)
+{
+	long n = ic_regcnt(c);
+	if (j >= n)
+		return c->args[j - n];
+	return j == 0 ? c->a1 : (j == 1 ? c->a2 : c->a3);
+}
+
+/* turn instruction i into an unused value, to be removed by io_deadcode() */
+static void ic_nop(long i)
+{
+	ic_free(&ic[i]);
+	ic[i].op = O_MK(O_MOV | O_NUM, ULNG);
+	ic[i].a1 = 0;
+	ic[i].a2 = 0;
+	ic[i].a3 = 0;
+}
+
+/* jump to the final destination of jumps to unconditional jumps */
+static void ly_thread(void)
+{
+	long i, j;
+	for (i = 0; i < ic_n; i++) {
+		long dst = ic[i].a3;
+		if (!(ic[i].op & O_JXX))
+			continue;
+		for (j = 0; j < 16 && O_C(ic[dst].op) == O_JMP; j++)
+			dst = ic[dst].a3;
+		ic[i].a3 = dst;
+	}
+}
+
+/* can block b be moved after the last placed block */
+static int ly_movable(long b)
+{
+	long beg = bb_beg[b];
+	long end = b + 1 < bb_n ? bb_beg[b + 1] : ic_n;
+	long i, j;
+	if (ly_placed[b] || !(ic[beg - 1].op & (O_JMP | O_RET)))
+		return 0;
+	/* its operands should be computed in placed blocks */
+	for (i = beg; i < end; i++) {
+		for (j = 0; j < ic_opndcnt(ic + i); j++) {
+			long x = ic_opnd(ic + i, j);
+			if ((x < beg || x >= end) && !ly_placed[bb_blk[x]])
+				return 0;
+		}
+	}
+	/* and its values should not be used in placed blocks */
+	return !ly_uses[b];
+}
+
+/* can the conditional block b be duplicated at the jumps to it */
+static int ly_rotatable(long b)
+{
+	long beg = bb_beg[b];
+	long end = b + 1 < bb_n ? bb_beg[b + 1] : ic_n;
+	long i;
+	if (!opt(2) || end - beg > LYROT || !(ic[end - 1].op & (O_JZ | O_JCC)))
+		return 0;
+	for (i = beg; i < end; i++)
+		if (ic[i].op & (O_CALL | O_MEM))
+			return 0;
+	/* its values should be used only inside it */
+	return !ly_ext[b];
+}
+
+/* place block b at position n of ly_ord[] */
+static void ly_place(long b, long n)
+{
+	long beg = bb_beg[b];
+	long end = b + 1 < bb_n ? bb_beg[b + 1] : ic_n;
+	long i, j;
+	ly_pos[b] = n;
+	ly_ord[n] = b;
+	ly_placed[b] = 1;
+	for (i = beg; i < end; i++) {
+		for (j = 0; j < ic_opndcnt(ic + i); j++) {
+			long x = ic_opnd(ic + i, j);
+			if (x < beg || x >= end)
+				ly_uses[bb_blk[x]]++;
+		}
+	}
+}
+
+/* order the blocks, placing the destination of jumps after them */
+static void ly_order(void)
+{
+	long n = 0;
+	long b, c;
+	for (b = 0; b < bb_n; b++) {
+		if (ly_placed[b])
+			continue;
+		c = b;
+		while (c >= 0) {
+			long last = (c + 1 < bb_n ? bb_beg[c + 1] : ic_n) - 1;
+			long op = ic[last].op;
+			long dst = op & O_JXX ? bb_blk[ic[last].a3] : -1;
+			ly_place(c, n++);
+			if (!(op & (O_JMP | O_RET)))
+				c = c + 1;
+			else if (O_C(op) == O_JMP && ly_movable(dst))
+				c = dst;
+			else
+				c = -1;
+		}
+	}
+}
+
+/* the block following the n-th block of ly_ord[] or -1 */
+static long ly_next(long n)
+{
+	return n + 1 < bb_n ? ly_ord[n + 1] : -1;
+}
+
+/* whether the jump at instruction i goes back to a rotatable loop header */
+static int ly_rotjmp(long i)
+{
+	long h;
+	if (O_C(ic[i].op) != O_JMP)
+		return 0;
+	h = bb_blk[ic[i].a3];
+	return ic[i].a3 == bb_beg[h] &&
+		ly_pos[h] <= ly_pos[bb_blk[i]] && ly_rotatable(h);
+}
+
+/* the copy of operand x in a duplicated block starting at beg */
+#define LYMAP(x, beg)	((x) >= (beg) ? cidx[x] : nidx[x])
+
+/* emit the instructions in the new block order */
+static void ly_emit(void)
+{
+	long *nidx = malloc(ic_n * sizeof(nidx[0]));
+	long *cidx = malloc(ic_n * sizeof(cidx[0]));
+	struct ic *nic;
+	long nic_n = 0, nic_sz = ic_n;
+	long n, i, j;
+	for (i = 0; i < ic_n; i++)
+		if (O_C(ic[i].op) == O_JMP && ly_rotjmp(i))
+			nic_sz += LYROT + 1;
+	nic = malloc(nic_sz * sizeof(nic[0]));
+	for (n = 0; n < bb_n; n++) {
+		long b = ly_ord[n];
+		long beg = bb_beg[b];
+		long end = b + 1 < bb_n ? bb_beg[b + 1] : ic_n;
+		for (i = beg; i < end; i++) {
+			struct ic *c = &nic[nic_n];
+			nidx[i] = nic_n;
+			if (i == end - 1 && ly_rotjmp(i))
+				break;
+			memcpy(c, &ic[i], sizeof(*c));
+			if (ic_regcnt(c) >= 1)
+				c->a1 = nidx[c->a1];
+			if (ic_regcnt(c) >= 2)
+				c->a2 = nidx[c->a2];
+			if (ic_regcnt(c) >= 3)
+				c->a3 = nidx[c->a3];
+			if (c->op & O_CALL)
+				for (j = 0; j < c->a3; j++)
+					c->args[j] = nidx[c->args[j]];
+			nic_n++;
+		}
+		/* duplicating the loop header instead of jumping to it */
+		if (i < end) {
+			long h = bb_blk[ic[i].a3];
+			long hbeg = bb_beg[h];
+			long hend = h + 1 < bb_n ? bb_beg[h + 1] : ic_n;
+			long next = ly_next(n);
+			for (j = hbeg; j < hend; j++) {
+				struct ic *c = &nic[nic_n];
+				cidx[j] = nic_n++;
+				memcpy(c, &ic[j], sizeof(*c));
+				long cnt = ic_regcnt(c);
+				if (cnt >= 1)
+					c->a1 = LYMAP(c->a1, hbeg);
+				if (cnt >= 2)
+					c->a2 = LYMAP(c->a2, hbeg);
+			}
+			/* continuing the loop by jumping to its body */
+			nic[nic_n - 1].op ^= 1;
+			nic[nic_n - 1].a3 = hend;
+			if (next < 0 || bb_beg[next] != ic[hend - 1].a3) {
+				nic[nic_n].op = O_JMP;
+				nic[nic_n].a3 = ic[hend - 1].a3;
+				nic_n++;
+			}
+			ic_stat_rot++;
+		}
+	}
+	/* branch targets */
+	for (i = 0; i < nic_n; i++)
+		if (nic[i].op & O_JXX)
+			nic[i].a3 = nidx[nic[i].a3];
+	free(ic);
+	ic = nic;
+	ic_n = nic_n;
+	ic_sz = nic_sz;
+	free(nidx);
+	free(cidx);
+}
+
+/* remove jumps to the next instruction and jumps over jumps */
+static void ly_jumps(void)
+{
+	char *dst = calloc(ic_n, sizeof(dst[0]));
+	char *del = calloc(ic_n + 1, sizeof(del[0]));
+	long i, t, k;
+	for (i = 0; i < ic_n; i++)
+		if (ic[i].op & O_JXX)
+			dst[ic[i].a3] = 1;
+	for (i = 0; i + 2 < ic_n; i++) {
+		if (ic[i].op & (O_JZ | O_JCC) && ic[i].a3 == i + 2 &&
+				O_C(ic[i + 1].op) == O_JMP && !dst[i + 1]) {
+			ic[i].op ^= 1;
+			ic[i].a3 = ic[i + 1].a3;
+			del[i + 1] = 1;
+		}
+	}
+	for (i = ic_n - 1; i >= 0; i--) {
+		if (!(ic[i].op & O_JXX) || del[i])
+			continue;
+		for (t = ic[i].a3; del[t]; t++)
+			;
+		for (k = i + 1; del[k]; k++)
+			;
+		if (t == k)
+			del[i] = 1;
+	}
+	for (i = 0; i < ic_n; i++)
+		if (del[i])
+			ic_nop(i);
+	free(dst);
+	free(del);
+}
+
+/* place basic blocks to turn jumps into fall-throughs */
+static void io_layout(void)
+{
+	long i, j;
+	ly_thread();
+	bb_init(ic, ic_n);
+	ly_ord = malloc(bb_n * sizeof(ly_ord[0]));
+	ly_pos = malloc(bb_n * sizeof(ly_pos[0]));
+	ly_placed = calloc(bb_n, sizeof(ly_placed[0]));
+	ly_uses = calloc(bb_n, sizeof(ly_uses[0]));
+	ly_ext = calloc(bb_n, sizeof(ly_ext[0]));
+	for (i = 0; i < ic_n; i++)
+		for (j = 0; j < ic_opndcnt(ic + i); j++)
+			if (bb_blk[ic_opnd(ic + i, j)] != bb_blk[i])
+				ly_ext[bb_blk[ic_opnd(ic + i, j)]] = 1;
+	ly_order();
+	ly_emit();
+	free(ly_ord);
+	free(ly_pos);
+	free(ly_placed);
+	free(ly_uses);
+	free(ly_ext);
+	bb_done();
+	ly_jumps();
+}
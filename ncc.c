@@ -1319,6 +1319,8 @@ static void localinit(void *obj, int off, struct type *t)
 
 /* current function name */
 static char func_name[NAMELEN];
+/* the return type of the current function */
+static int func_ret;
 
 static void localdef(long data, struct name *name, unsigned flags)
 {
@@ -1571,7 +1573,7 @@ static void readstmt(void)
 			ts_pop_de(NULL);
 		}
 		tok_req(";");
-		o_ret(ret);
+		o_ret(ret ? (func_ret ? func_ret : ULNG) : 0);
 		return;
 	}
 	if (!tok_jmp("break")) {
@@ -1604,6 +1606,7 @@ static void readfunc(struct name *name, int flags)
 	int i;
 	Elf_Sym *sym;
 	strcpy(func_name, fi->name);
+	func_ret = TYPE_BT(&fi->ret);
 	sym = o_func_beg(func_name, fi->nargs, F_GLOBAL(flags), fi->varg);
 	for (i = 0; i < fi->nargs; i++) {
 		struct name arg = {"", "", fi->args[i], o_arg2loc(i)};
@@ -1654,6 +1657,7 @@ static void compat_macros(void)
 }
 
 static int ncc_opt = 2;
+static int ncc_stats;
 
 /* return one if the given optimization level is enabled */
 int opt(int level)
@@ -1682,6 +1686,8 @@ int main(int argc, char *argv[])
 			}
 			cpp_define(name, def);
 		}
+		if (argv[i][1] == 's')
+			ncc_stats = 1;
 		if (argv[i][1] == 'o')
 			strcpy(obj, argv[i][2] ? argv[i] + 2 : argv[++i]);
 		if (argv[i][1] == 'h') {
@@ -1692,6 +1698,7 @@ int main(int argc, char *argv[])
 			printf("  -o out     \tspecify output file name\n");
 			printf("  -Dname=val \tdefine a macro\n");
 			printf("  -On        \toptimize (-O0 to disable)\n");
+			printf("  -s         \tprint optimization statistics\n");
 			return 0;
 		}
 	}
@@ -1717,6 +1724,8 @@ int main(int argc, char *argv[])
 	ofd = open(obj, O_WRONLY | O_TRUNC | O_CREAT, 0600);
 	o_write(ofd);
 	close(ofd);
+	if (ncc_stats)
+		ic_stats();
 	return 0;
 }
 
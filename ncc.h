@@ -115,13 +115,15 @@ int cpp_read(char **buf, long *len);
 /*
  * Intermediate instruction operands
  * R: register, N: immediate, S: symbol, L: local,
- * D: displacement, G: label, C: arguments
+ * D: displacement, G: label, C: arguments,
+ * X: index register shifted by the low bits of the opcode,
+ * M: memory at the register plus the displacement (O_IND)
  */
 /* Instruction				rd	r1	r2	r3 */
-#define O_ADD	0x000010	/*	R	R	RN	-  */
+#define O_ADD	0x000010	/*	R	R	RNM	D  */
 #define O_SHL	0x000020	/*	R	R	RN	-  */
 #define O_MUL	0x000040	/*	R	R	RN	-  */
-#define O_CMP	0x000080	/*	R	R	RN	-  */
+#define O_CMP	0x000080	/*	R	R	RNM	D  */
 #define O_UOP	0x000100	/*	R	R	-	-  */
 #define O_CALL	0x000200	/*	R	RS	D	C  */
 #define O_MOV	0x000400	/*	R	RNSL	D	-  */
@@ -130,12 +132,13 @@ int cpp_read(char **buf, long *len);
 #define O_JZ	0x002000	/*	-	R	-	G  */
 #define O_JCC	0x004000	/*	-	R	RN	G  */
 #define O_RET	0x008000	/*	-	R	-	-  */
-#define O_LD	0x010000	/*	R	RSL	D	-  */
-#define O_ST	0x020000	/*	-	R	RSL	D  */
-/* opcode flags: num, loc, sym */
+#define O_LD	0x010000	/*	R	RSL	DX	-  */
+#define O_ST	0x020000	/*	-	R	RSL	DX */
+/* opcode flags: num, loc, sym, ind */
 #define O_NUM	0x100000	/* instruction immediate */
 #define O_LOC	0x200000	/* local (frame pointer displacement) */
 #define O_SYM	0x400000	/* symbols (relocations and offset) */
+#define O_IND	0x800000	/* the second operand is in memory */
 /* other members of instruction groups */
 #define O_SUB		(1 | O_ADD)
 #define O_AND		(2 | O_ADD)
@@ -144,6 +147,7 @@ int cpp_read(char **buf, long *len);
 #define O_SHR		(1 | O_SHL)
 #define O_DIV		(1 | O_MUL)
 #define O_MOD		(2 | O_MUL)
+#define O_MULH		(3 | O_MUL)	/* the high half of the product */
 #define O_LT		(0 | O_CMP)
 #define O_GE		(1 | O_CMP)
 #define O_EQ		(2 | O_CMP)
@@ -222,15 +226,20 @@ void ic_get(struct ic **c, long *n);
 int ic_num(struct ic *ic, long iv, long *num);
 int ic_sym(struct ic *ic, long iv, long *sym, long *off);
 long *ic_lastuse(struct ic *ic, long ic_n);
+long *ic_loopdepth(struct ic *ic, long ic_n);
 void ic_free(struct ic *ic);
+void ic_inline(long sym, struct ic *ic, long ic_n,
+		long argc, long *loc_len, long loc_n);
+void ic_stats(void);
 int ic_regcnt(struct ic *ic);
 
 /* global register allocation */
-void reg_init(struct ic *ic, long ic_n);
+void reg_init(struct ic *ic, long ic_n, long keep);
 long reg_mask(void);
 int reg_lmap(long ic, long loc);
 int reg_rmap(long ic, long reg);
 int reg_safe(long loc);
+void reg_span(long *beg, long *end);
 void reg_done(void);
 
 /* SECTION FOUR: Final Code Generation */
@@ -270,7 +279,23 @@ void reg_done(void);
  * by calling os() and oi() functions and the current position in
  * the code segment is obtained by calling opos().  For branch
  * instructions, i_ins() returns the position of branch offset in
- * code segment, to be filled later with i_fill().
+ * code segment, to be filled later with i_fill().  For calls, r3
+ * is the number of arguments passed on the stack; calls with O_RET
+ * are tail calls, which should release the stack frame and jump to
+ * the callee.
+ *
+ * i_guard() asks the backend to return from the function before
+ * its prologue, if jump op (O_JZ or O_JCC) on register r1 and r2
+ * would be taken at its entry.  The returned value is the immediate
+ * ret if rop is O_MOV | O_NUM and register ret if it is O_MOV.  It
+ * returns nonzero if the backend cannot generate such an exit.
+ *
+ * i_wrap() adds the prologue and epilogue of the function; its first
+ * aregs arguments arrive in argregs.  If I_REGENT is nonzero, the
+ * symbol of each function is an entry taking all arguments on the
+ * stack, which loads the first aregs arguments into argregs with
+ * I_REGENT-byte instructions before reaching the register entry.
+ * Callers reserve stack slots for arguments passed in registers.
  *
  * Some macros should be defined in architecture-dependent headers
  * and a few variables should be defined for each architecture,
@@ -299,7 +324,8 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *mt);
 long i_ins(long op, long rd, long r1, long r2, long r3);
 int i_imm(long lim, long n);
 void i_label(long id);
-void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs_pos);
+long i_guard(long op, long r1, long r2, long rop, long ret);
+void i_wrap(int argc, int aregs, long sargs, long spsub, int initfp, long sregs, long sregs_pos);
 void i_code(char **c, long *c_len, long **rsym, long **rflg, long **roff, long *rcnt);
 void i_done(void);
 
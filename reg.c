@@ -40,6 +40,13 @@ static int loc_n;		/* number of locals */
 
 static long *dst_head;		/* lists of jumps to each instruction */
 static long *dst_next;		/* next entries in dst_head[] lists */
+static long *ic_wgt;		/* access weight of each instruction */
+static long *acc_head;		/* lists of loads and stores of each local */
+static long *acc_next;		/* next entries in acc_head[] lists */
+static long *acc_mark;		/* instructions visited for each local, plus one */
+
+/* the weight of accesses inside depth nested loops */
+#define LOOPWGT(depth)		(1l << (3 * MIN((depth), 6)))
 
 static void rgn_add(long loc, long beg, long end, long cnt)
 {
@@ -83,7 +90,7 @@ static int rgn_available(long beg, long end, int reg)
 }
 
 static long reg_region(struct ic *ic, long ic_n, long loc, long pos,
-		long *beg, long *end, char *mark)
+		long *beg, long *end)
 {
 	long cnt = 0;
 	long dst;
@@ -92,16 +99,16 @@ static long reg_region(struct ic *ic, long ic_n, long loc, long pos,
 			*beg = pos;
 		if (pos + 1 > *end)
 			*end = pos + 1;
-		if (mark[pos])
+		if (acc_mark[pos] == loc + 1)
 			break;
-		mark[pos] = 1;
+		acc_mark[pos] = loc + 1;
 		if (IC_LST(ic, pos) == loc)
 			break;
 		if (IC_LLD(ic, pos) == loc)
-			cnt++;
+			cnt += ic_wgt[pos];
 		dst = dst_head[pos];
 		while (dst >= 0) {
-			cnt += reg_region(ic, ic_n, loc, dst, beg, end, mark);
+			cnt += reg_region(ic, ic_n, loc, dst, beg, end);
 			dst = dst_next[dst];
 		}
 		if (pos > 0 && ic[pos - 1].op & O_JMP)
@@ -113,38 +120,34 @@ static long reg_region(struct ic *ic, long ic_n, long loc, long pos,
 /* compute local's live regions */
 static void reg_regions(struct ic *ic, long ic_n, long loc)
 {
-	char *mark;
 	long beg, end;
 	long cnt;
 	long i;
-	mark = calloc(ic_n, sizeof(mark[0]));
-	for (i = 0; i < ic_n; i++) {
-		if (IC_LLD(ic, i) == loc && !mark[i]) {
+	for (i = acc_head[loc]; i >= 0; i = acc_next[i]) {
+		if (IC_LLD(ic, i) == loc && acc_mark[i] != loc + 1) {
 			beg = i;
 			end = i + 1;
-			cnt = reg_region(ic, ic_n, loc, i, &beg, &end, mark);
+			cnt = reg_region(ic, ic_n, loc, i, &beg, &end);
 			rgn_add(loc, beg, end, cnt);
 		}
 	}
-	for (i = 0; i < ic_n; i++)
-		if (IC_LST(ic, i) == loc && !mark[i])
-			rgn_add(loc, i, i + 1, 1);
-	free(mark);
+	for (i = acc_head[loc]; i >= 0; i = acc_next[i])
+		if (IC_LST(ic, i) == loc && acc_mark[i] != loc + 1)
+			rgn_add(loc, i, i + 1, ic_wgt[i]);
 }
 
-/* number of times a local is accessed */
+/* number of times a local is accessed, weighted by loop depth */
 static long reg_loccnt(struct ic *ic, long ic_n, long loc)
 {
 	long cnt = 0;
 	long i;
-	for (i = 0; i < ic_n; i++)
-		if (IC_LLD(ic, i) == loc || IC_LST(ic, i) == loc)
-			cnt++;
+	for (i = acc_head[loc]; i >= 0; i = acc_next[i])
+		cnt += ic_wgt[i];
 	return cnt;
 }
 
 /* perform global register allocation */
-static void reg_glob(int leaf)
+static void reg_glob(int leaf, long keep)
 {
 	int *srt;
 	int regs[N_REGS];
@@ -152,7 +155,11 @@ static void reg_glob(int leaf)
 	int regs_max = MIN(N_TMPS >> 1, 4);
 	long regs_mask = leaf ? R_TMPS : R_PERM;
 	int regs_n = 0;
-	for (i = leaf ? 1 : 3; i < N_TMPS && regs_n < regs_max; i++)
+	/* registers that survive the calls need not be saved */
+	for (i = 0; i < N_TMPS && !leaf && regs_n < regs_max; i++)
+		if ((1 << i) & keep)
+			regs[regs_n++] = i;
+	for (i = leaf ? 1 : 0; i < N_TMPS && regs_n < regs_max; i++)
 		if ((1 << i) & regs_mask)
 			regs[regs_n++] = i;
 	srt = malloc(rgn_n * sizeof(srt[0]));
@@ -184,7 +191,7 @@ static void reg_glob(int leaf)
 	free(srt);
 }
 
-void reg_init(struct ic *ic, long ic_n)
+void reg_init(struct ic *ic, long ic_n, long keep)
 {
 	long loc, off;
 	int *loc_sz;
@@ -228,13 +235,31 @@ void reg_init(struct ic *ic, long ic_n)
 			dst_head[ic[i].a3] = i;
 		}
 	}
+	ic_wgt = ic_loopdepth(ic, ic_n);
+	for (i = 0; i < ic_n; i++)
+		ic_wgt[i] = LOOPWGT(ic_wgt[i]);
+	acc_head = malloc(loc_n * sizeof(acc_head[0]));
+	acc_next = malloc(ic_n * sizeof(acc_next[0]));
+	acc_mark = calloc(ic_n, sizeof(acc_mark[0]));
+	for (i = 0; i < loc_n; i++)
+		acc_head[i] = -1;
+	for (i = ic_n - 1; i >= 0; i--) {
+		long loc = IC_LLD(ic, i) >= 0 ? IC_LLD(ic, i) : IC_LST(ic, i);
+		if (loc >= 0) {
+			acc_next[i] = acc_head[loc];
+			acc_head[loc] = i;
+		}
+	}
 	for (i = 0; i < loc_n; i++) {
 		if (!loc_ptr[i] && opt(2))
 			reg_regions(ic, ic_n, i);
 		if (!loc_ptr[i] && !opt(2))
 			rgn_add(i, 0, ic_n, reg_loccnt(ic, ic_n, i));
 	}
-	reg_glob(leaf);
+	free(acc_head);
+	free(acc_next);
+	free(acc_mark);
+	reg_glob(leaf, keep);
 }
 
 long reg_mask(void)
@@ -269,10 +294,23 @@ int reg_rmap(long c, long reg)
 	return -1;
 }
 
+/* extend the live spans of locals to include their register regions */
+void reg_span(long *beg, long *end)
+{
+	int i;
+	for (i = 0; i < rgn_n; i++) {
+		if (rgn[i].reg >= 0) {
+			beg[rgn[i].loc] = MIN(beg[rgn[i].loc], rgn[i].beg);
+			end[rgn[i].loc] = MAX(end[rgn[i].loc], rgn[i].end);
+		}
+	}
+}
+
 void reg_done(void)
 {
 	free(dst_head);
 	free(dst_next);
+	free(ic_wgt);
 	free(loc_ptr);
 	free(rgn);
 	loc_ptr = NULL;
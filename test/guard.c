@@ -0,0 +1,71 @@
+/*
+ * Early exits before the prologue
+ *
+ * Functions whose first statement returns a constant or an argument
+ * when an argument fails a test, followed by bodies that need a stack
+ * frame or callee-saved registers.  Compile with -O1 or -O2, link with
+ * the C library of the target, and run; the exit status is nonzero on
+ * failure.
+ */
+struct node {
+	struct node *next;
+	long val;
+};
+
+static long sum(struct node *p)
+{
+	if (!p)
+		return 0;
+	return p->val + sum(p->next);
+}
+
+long clamp(long n, long d)
+{
+	long a[4];
+	long i;
+	if (n < 1)
+		return d;
+	for (i = 0; i < 4; i++)
+		a[i] = n * i;
+	return a[1] + a[2] + a[3];
+}
+
+long mix(long x, long y)
+{
+	long a, b, c, d, e;
+	if (x > 100)
+		return y;
+	a = x + 1;
+	b = x + 2;
+	c = x * 3;
+	d = y - 4;
+	e = y ^ 5;
+	a += mix(x + 50, y);
+	return a + b + c + d + e;
+}
+
+long loop(long n)
+{
+	long s = 0;
+again:
+	if (n == 0)
+		return s;
+	s += n--;
+	goto again;
+}
+
+int main(void)
+{
+	struct node n3 = {0, 3};
+	struct node n2 = {&n3, 2};
+	struct node n1 = {&n2, 1};
+	if (sum(0) != 0 || sum(&n1) != 6)
+		return 1;
+	if (clamp(0, 9) != 9 || clamp(-5, 4) != 4 || clamp(2, 9) != 12)
+		return 2;
+	if (mix(101, 7) != 7 || mix(1, 10) != 318)
+		return 3;
+	if (loop(0) != 0 || loop(4) != 10)
+		return 4;
+	return 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * Operand ordering
+ *
+ * Binary operations whose right operand needs more registers than the
+ * left one; with -O1 or -O2 the right operand of o1() and o2() is
+ * computed first, as reported by -s.  The operands of o3() share loads
+ * and keep their order.  Compile, link with the C library of the
+ * target, and run; the exit status is nonzero on failure.
+ */
+long o1(long a, long b, long c, long d, long e, long f)
+{
+	return a * b + (c * d + e * f);
+}
+
+long o2(long a, long b, long c, long d, long e, long f)
+{
+	return (a + b) - (c - d) * (e - f);
+}
+
+long o3(long *p, long a, long b)
+{
+	return p[0] * a - (p[1] * b + p[2] * (a - b));
+}
+
+int main(void)
+{
+	long p[3] = {2, 3, 5};
+	if (o1(1, 2, 3, 4, 5, 6) != 44)
+		return 1;
+	if (o2(1, 2, 3, 4, 6, 5) != 4)
+		return 2;
+	if (o3(p, 7, 4) != -13)
+		return 3;
+	return 0;
+}
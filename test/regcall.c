@@ -0,0 +1,73 @@
+/*
+ * Calling conventions
+ *
+ * Calls to static and recursive functions, through function pointers,
+ * and to functions of the C library, variadic ones and ones calling
+ * back into this file.  With X86_REGPARM, only direct calls to
+ * functions defined earlier pass arguments in registers.  Compile,
+ * link with the C library of the target, and run; the exit status is
+ * nonzero on failure.
+ */
+int snprintf(char *s, long n, char *fmt, ...);
+int strcmp(char *s1, char *s2);
+void qsort(void *a, long n, long sz, int (*cmp)(void *, void *));
+
+static long mix(long a, long b, long c, long d, long e)
+{
+	return a * 10000 + b * 1000 + c * 100 + d * 10 + e;
+}
+
+static long fact(long n)
+{
+	return n > 1 ? n * fact(n - 1) : 1;
+}
+
+static long inc(long *p, long a)
+{
+	return *p += a;
+}
+
+static long addr(long a, long b, long c)
+{
+	inc(&b, c);
+	return mix(a, b, c, 0, 0);
+}
+
+static int cmp(void *a, void *b)
+{
+	return *(int *) a - *(int *) b;
+}
+
+static long sum(long n, ...)
+{
+	long *ap = &n + 1;
+	long s = 0;
+	while (n--)
+		s = s * 10 + *ap++;
+	return s;
+}
+
+static long tail(long a, long b, long c)
+{
+	return mix(c, b, a, 1, 2);
+}
+
+int main(void)
+{
+	long (*fp)(long, long, long, long, long) = mix;
+	int a[4] = {3, 1, 4, 2};
+	char buf[32];
+	if (mix(1, 2, 3, 4, 5) != 12345 || fp(5, 4, 3, 2, 1) != 54321)
+		return 1;
+	if (fact(6) != 720 || addr(1, 2, 3) != 15300)
+		return 2;
+	if (sum(3, 1L, 2L, 3L) != 123 || tail(1, 2, 3) != 32112)
+		return 3;
+	snprintf(buf, sizeof(buf), "%d %s %d", 12, "ab", 34);
+	if (strcmp(buf, "12 ab 34"))
+		return 4;
+	qsort(a, 4, sizeof(a[0]), cmp);
+	if (a[0] != 1 || a[1] != 2 || a[2] != 3 || a[3] != 4)
+		return 5;
+	return 0;
+}
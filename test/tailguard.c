@@ -0,0 +1,58 @@
+/*
+ * Entry guards and tail calls
+ *
+ * Functions whose only exit is a tail call, some with an entry guard
+ * that removes their only return.  Each follows a function whose code
+ * length once made the code generator remove the jump to the tail
+ * call.  Compile with -O1 or -O2, link with the C library of the
+ * target, and run; the exit status is nonzero on failure.
+ */
+long ext(long a, long b)
+{
+	return a - b;
+}
+
+long p1(long a, long b)
+{
+	return a + b * 2 + b * 3;
+}
+
+long t1(long a, long b)
+{
+	return ext(a + b * 2 + b * 3, b);
+}
+
+long p2(long a, long b)
+{
+	return (a ^ 100000) ^ 100000;
+}
+
+static long g2(long a, long b)
+{
+	if (a == 0)
+		return b;
+	return g2(a - 1, b * 2);
+}
+
+long p3(long a, long b)
+{
+	return (a * 3) ^ 100000;
+}
+
+static long g3(long a, long b)
+{
+	if (a == 0)
+		return b;
+	return g3(a - 1, b * 2);
+}
+
+int main(void)
+{
+	if (p1(1, 2) != 11 || t1(1, 2) != 9)
+		return 1;
+	if (p2(1, 2) != 1 || g2(3, 1) != 8)
+		return 2;
+	if (p3(1, 2) != (3 ^ 100000) || g3(3, 1) != 8)
+		return 3;
+	return 0;
+}
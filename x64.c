@@ -11,8 +11,11 @@
 #define R_RBP		0x05
 #define R_RSI		0x06
 #define R_RDI		0x07
+#define R_R10		0x0a
+#define R_R11		0x0b
 
 #define REG_RET		R_RAX
+#define REG_TAIL	R_R11	/* the destination of indirect tail calls */
 
 /* x86 opcodes */
 #define I_MOV		0x89
@@ -78,7 +81,8 @@ static long opos(void)
 	return mem_len(&cs);
 }
 
-static void op_x(int op, int r1, int r2, int bt)
+/* the instruction prefix and opcode; ri is the SIB index register */
+static void op_xi(int op, int r1, int r2, int ri, int bt)
 {
 	int sz = T_SZ(bt);
 	int rex = 0;
@@ -88,6 +92,8 @@ static void op_x(int op, int r1, int r2, int bt)
 		rex |= 0x40;
 	if (r1 & 0x8)
 		rex |= 4;
+	if (ri & 0x8)
+		rex |= 2;
 	if (r2 & 0x8)
 		rex |= 1;
 	if (sz == 2)
@@ -99,6 +105,11 @@ static void op_x(int op, int r1, int r2, int bt)
 	oi(sz == 1 ? O1(op) & ~0x1 : O1(op), 1);
 }
 
+static void op_x(int op, int r1, int r2, int bt)
+{
+	op_xi(op, r1, r2, 0, bt);
+}
+
 #define op_mr		op_rm
 
 /* op_*(): r=reg, m=mem, i=imm, s=sym */
@@ -116,6 +127,17 @@ static void op_rm(int op, int src, int base, int off, int bt)
 		oi(off, dis);
 }
 
+/* memory operand [base + (idx << s)] */
+static void op_rx(int op, int src, int base, int idx, int s, int bt)
+{
+	int mod = (base & 7) == R_RBP;
+	op_xi(op, src, base, idx, bt);
+	oi(MODRM(mod, src & 0x07, 4), 1);
+	oi((s << 6) | ((idx & 0x07) << 3) | (base & 0x07), 1);
+	if (mod)
+		oi(0, 1);
+}
+
 static void op_rr(int op, int src, int dst, int bt)
 {
 	op_x(op, src, dst, bt);
@@ -164,6 +186,13 @@ static void i_add(int op, int rd, int r1, int r2)
 	op_rr(rx[op & 0x0f], rd, r2, LONGSZ);
 }
 
+static void i_add_mem(int op, int rd, int base, long off)
+{
+	/* opcode for O_ADD, O_SUB, O_AND, O_OR, O_XOR */
+	static int rx[] = {0003, 0053, 0043, 0013, 0063};
+	op_rm(rx[op & 0x0f], rd, base, off, LONGSZ);
+}
+
 static void i_add_imm(int op, int rd, int rn, long n)
 {
 	/* opcode for O_ADD, O_SUB, O_AND, O_OR, O_XOR */
@@ -209,6 +238,42 @@ static void i_div(int op, int rd, int r1, int r2)
 	op_rr(I_MUL, bt & T_MSIGN ? 7 : 6, r2, LONGSZ);
 }
 
+static void i_mulh(int op, int rd, int r1, int r2)
+{
+	op_rr(I_MUL, O_T(op) & T_MSIGN ? 5 : 4, r2, LONGSZ);
+}
+
+/* rep movs or stos of rcx bytes: words first and then the rest */
+static void i_blk(int stos)
+{
+	os("\x48\x89\xca", 3);		/* mov rdx, rcx */
+	os("\x48\xc1\xe9\x03", 4);	/* shr rcx, 3 */
+	if (stos)
+		os("\xfc\xf3\x48\xab", 4);	/* cld; rep stosq */
+	else
+		os("\xfc\xf3\x48\xa5", 4);	/* cld; rep movsq */
+	os("\x89\xd1", 2);		/* mov ecx, edx */
+	os("\x83\xe1\x07", 3);		/* and ecx, 7 */
+	if (stos)
+		os("\xf3\xaa", 2);		/* rep stosb */
+	else
+		os("\xf3\xa4", 2);		/* rep movsb */
+}
+
+static void i_memcpy(void)
+{
+	i_blk(0);
+}
+
+static void i_memset(void)
+{
+	os("\x0f\xb6\xc0", 3);		/* movzx eax, al */
+	/* mov rdx, 0x0101010101010101 */
+	os("\x48\xba\x01\x01\x01\x01\x01\x01\x01\x01", 10);
+	os("\x48\x0f\xaf\xc2", 4);	/* imul rax, rdx */
+	i_blk(1);
+}
+
 static void i_tst(int rn, int rm)
 {
 	op_rr(I_TST, rn, rm, LONGSZ);
@@ -219,6 +284,11 @@ static void i_cmp(int rn, int rm)
 	op_rr(I_CMP, rn, rm, LONGSZ);
 }
 
+static void i_cmp_mem(int rn, int base, long off)
+{
+	op_rm(I_CMP, rn, base, off, LONGSZ);
+}
+
 static void i_cmp_imm(int rn, long n)
 {
 	unsigned char s[4] = {REX(0, rn), 0x83, 0xf8 | rn, n & 0xff};
@@ -370,7 +440,17 @@ static long jmp_n, jmp_sz;	/* jump count */
 static long *jmp_off;		/* jump offsets */
 static long *jmp_dst;		/* jump destinations */
 static long *jmp_op;		/* jump opcode */
-static long jmp_ret;		/* the position of the last return jmp */
+static long jmp_ret = -1;	/* the position of the last return jmp */
+static long lab_last;		/* the last label of the current function */
+
+static long *tc_sym;		/* tail call symbols (-1 for REG_TAIL) */
+static long *tc_off;		/* tail call symbol offsets */
+static long *tc_jmp;		/* tail call jumps in jmp_off[] */
+static long tc_n, tc_sz;	/* tail call count */
+
+static long gd_op;		/* the jump of the entry guard (i_guard()) */
+static long gd_r1, gd_r2;	/* the operands of the entry guard */
+static long gd_rop, gd_ret;	/* the value returned by the entry guard */
 
 static void lab_add(long id)
 {
@@ -399,6 +479,23 @@ static void jmp_add(long op, long off, long dst)
 void i_label(long id)
 {
 	lab_add(id + 1);
+	lab_last = id + 1;
+}
+
+/* jump to the exit of a tail call, generated in i_wrap() */
+static void i_tailcall(long sym, long off)
+{
+	if (tc_n == tc_sz) {
+		tc_sz = MAX(16, tc_sz * 2);
+		tc_sym = mextend(tc_sym, tc_n, tc_sz, sizeof(*tc_sym));
+		tc_off = mextend(tc_off, tc_n, tc_sz, sizeof(*tc_off));
+		tc_jmp = mextend(tc_jmp, tc_n, tc_sz, sizeof(*tc_jmp));
+	}
+	tc_sym[tc_n] = sym;
+	tc_off[tc_n] = off;
+	tc_jmp[tc_n] = jmp_n;
+	tc_n++;
+	jmp_add(O_JMP, i_jmp(O_JMP, 4), 0);
 }
 
 static void i_rel(long sym, long flg, long off)
@@ -479,7 +576,32 @@ static void regs_load(long sregs, long dis)
 			i_pop(i);
 }
 
-void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs_pos)
+long i_guard(long op, long r1, long r2, long rop, long ret)
+{
+	gd_op = op;
+	gd_r1 = r1;
+	gd_r2 = r2;
+	gd_rop = rop;
+	gd_ret = ret;
+	return 0;
+}
+
+/* return before the prologue, if the entry guard holds */
+static void i_guardret(void)
+{
+	long pos;
+	i_jcmp(gd_op, gd_r1, gd_r2);
+	pos = i_jmp(gd_op ^ 1, 1);
+	if (gd_rop & O_NUM)
+		i_num(REG_RET, gd_ret);
+	else if (gd_ret != REG_RET)
+		i_mov(REG_RET, gd_ret);
+	os("\xc3", 1);			/* ret */
+	oi_at(pos, opos() - pos - 1, 1);
+	gd_op = 0;
+}
+
+void i_wrap(int argc, int aregs, long sargs, long spsub, int initfp, long sregs, long sregs_pos)
 {
 	long body_n;
 	void *body;
@@ -496,6 +618,8 @@ void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs
 	body_n = mem_len(&cs);
 	body = mem_get(&cs);
 	/* generating function prologue */
+	if (gd_op)
+		i_guardret();
 	if (sargs)
 		i_saveargs(sargs);
 	if (initfp) {
@@ -533,6 +657,29 @@ void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs
 		jmp_off[i] += diff;
 	for (i = 0; i < lab_sz; i++)
 		lab_loc[i] += diff;
+	/* tail call exits: releasing the frame and jumping to the callee */
+	for (i = 0; i < tc_n; i++) {
+		jmp_dst[tc_jmp[i]] = lab_last + 1 + i;
+		lab_add(lab_last + 1 + i);
+		if (sregs)
+			regs_load(sregs, spsub + sregs_pos);
+		if (initfp)
+			os("\xc9", 1);		/* leave */
+		if (sargs) {			/* dropping saved arguments */
+			i_pop(R_R10);
+			i_subsp(-nsargs * LONGSZ);
+			i_push(R_R10);
+		}
+		if (tc_sym[i] >= 0) {
+			os("\xe9", 1);		/* jmp $x */
+			i_rel(tc_sym[i], OUT_CS | OUT_RLREL, opos());
+			oi(-4 + tc_off[i], 4);
+		} else {
+			op_rr(I_CALL, 4, REG_TAIL, LONGSZ);	/* jmp *r11 */
+		}
+	}
+	tc_n = 0;
+	jmp_ret = -1;
 }
 
 /* introduce shorter jumps, if possible */
@@ -600,6 +747,9 @@ void i_done(void)
 	free(jmp_dst);
 	free(jmp_op);
 	free(lab_loc);
+	free(tc_sym);
+	free(tc_off);
+	free(tc_jmp);
 }
 
 long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
@@ -610,6 +760,9 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 	*r2 = 0;
 	*r3 = 0;
 	*tmp = 0;
+	/* memory operands: only for additions and comparisons */
+	if (oc & O_IND && !(oc & (O_ADD | O_CMP)))
+		return 1;
 	if (oc & O_MOV) {
 		*rd = R_TMPS;
 		*r1 = oc & (O_NUM | O_SYM) ? 32 : R_TMPS;
@@ -633,7 +786,7 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 	if (oc & O_MUL) {
 		if (oc & O_NUM)
 			return 1;
-		*rd = oc == O_MOD ? (1 << R_RDX) : (1 << R_RAX);
+		*rd = oc == O_MOD || oc == O_MULH ? (1 << R_RDX) : (1 << R_RAX);
 		*r1 = (1 << R_RAX);
 		*r2 = R_TMPS & ~*rd & ~*r1;
 		if (oc == O_DIV)
@@ -658,14 +811,16 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 		*r1 = 1 << R_RDI;
 		*r2 = 1 << R_RAX;
 		*r3 = 1 << R_RCX;
-		*tmp = (1 << R_RDI) | (1 << R_RCX);
+		*tmp = (1 << R_RDI) | (1 << R_RAX) | (1 << R_RCX) |
+			(1 << R_RDX);
 		return 0;
 	}
 	if (oc == O_MCPY) {
 		*r1 = 1 << R_RDI;
 		*r2 = 1 << R_RSI;
 		*r3 = 1 << R_RCX;
-		*tmp = (1 << R_RDI) | (1 << R_RSI) | (1 << R_RCX);
+		*tmp = (1 << R_RDI) | (1 << R_RSI) | (1 << R_RCX) |
+			(1 << R_RDX);
 		return 0;
 	}
 	if (oc == O_RET) {
@@ -675,6 +830,8 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 	if (oc & O_CALL) {
 		*rd = (1 << REG_RET);
 		*r1 = oc & O_SYM ? 0 : R_TMPS;
+		if (oc & O_RET && !(oc & O_SYM))
+			*r1 = 1 << REG_TAIL;
 		*tmp = R_TMPS & ~R_PERM;
 		return 0;
 	}
@@ -720,6 +877,8 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 				i_add_imm(op, r1, r1, r2);
 			else
 				i_add_anyimm(rd, r1, r2);
+		} else if (oc & O_IND) {
+			i_add_mem(op, r1, r2, r3);
 		} else {
 			i_add(op, r1, r1, r2);
 		}
@@ -737,11 +896,15 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 			i_div(op, R_RAX, r1, r2);
 		if (oc == O_MOD)
 			i_div(op, R_RDX, r1, r2);
+		if (oc == O_MULH)
+			i_mulh(op, R_RDX, r1, r2);
 		return 0;
 	}
 	if (oc & O_CMP) {
 		if (oc & O_NUM)
 			i_cmp_imm(r1, r2);
+		else if (oc & O_IND)
+			i_cmp_mem(r1, r2, r3);
 		else
 			i_cmp(r1, r2);
 		i_set(op, rd);
@@ -756,6 +919,10 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 			i_lnot(r1);
 		return 0;
 	}
+	if (oc & O_CALL && oc & O_RET) {
+		i_tailcall(oc & O_SYM ? r1 : -1, r2);
+		return 0;
+	}
 	if (oc == O_CALL) {
 		op_rr(I_CALL, 2, r1, LONGSZ);
 		return 0;
@@ -775,11 +942,11 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 		return 0;
 	}
 	if (oc == O_MSET) {
-		os("\xfc\xf3\xaa", 3);		/* cld; rep stosb */
+		i_memset();
 		return 0;
 	}
 	if (oc == O_MCPY) {
-		os("\xfc\xf3\xa4", 3);		/* cld; rep movs */
+		i_memcpy();
 		return 0;
 	}
 	if (oc == O_RET) {
@@ -795,6 +962,14 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 		op_rm(I_MOV, r1, r2, r3, bt);
 		return 0;
 	}
+	if ((oc & ~0x0f) == O_LD) {
+		op_rx(movrx_op(bt, I_MOVR), rd, r1, r2, oc & 0x0f, movrx_bt(bt));
+		return 0;
+	}
+	if ((oc & ~0x0f) == O_ST) {
+		op_rx(I_MOV, r1, r2, r3, oc & 0x0f, bt);
+		return 0;
+	}
 	if (oc == O_MOV) {
 		i_cast(rd, r1, bt);
 		return 0;
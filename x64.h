@@ -14,5 +14,9 @@
 
 #define I_ARG0		(-16)	/* offset of the first argument from FP */
 #define I_LOC0		0	/* offset of the first local from FP */
+#define I_REGENT	0	/* all functions take arguments in registers */
+
+#define I_MEMMAX	64	/* the longest unrolled block copy or fill */
+#define I_MEMWORD	8	/* the widest access in unrolled blocks */
 
 #define X64_ABS_RL	(OUT_RL32)	/* x86_64 memory model */
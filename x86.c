@@ -13,6 +13,7 @@
 #define R_RDI		0x07
 
 #define REG_RET		R_RAX
+#define REG_TAIL	R_RCX	/* the destination of indirect tail calls */
 #define R_BYTE		0x0007
 
 /* x86 opcodes */
@@ -36,8 +37,16 @@
 #define MIN(a, b)		((a) < (b) ? (a) : (b))
 #define ALIGN(x, a)		(((x) + (a) - 1) & ~((a) - 1))
 
+#ifdef X86_OMITFP
+int tmpregs[] = {0, 1, 2, 6, 7, 3, 5};
+#else
 int tmpregs[] = {0, 1, 2, 6, 7, 3};
+#endif
+#ifdef X86_REGPARM
+int argregs[] = {0, 2, 1};
+#else
 int argregs[] = {0};
+#endif
 
 #define OP2(o2, o1)		(0x010000 | ((o2) << 8) | (o1))
 #define O2(op)			(((op) >> 8) & 0xff)
@@ -90,11 +99,42 @@ static void op_x(int op, int r1, int r2, int bt)
 
 #define op_mr		op_rm
 
+#ifdef X86_OMITFP
+#define FP_SLOT		ULNG	/* the stack slot of the omitted frame pointer */
+#else
+#define FP_SLOT		0
+#endif
+
+static long *fp_pos;		/* offsets of esp-relative frame accesses */
+static long *fp_dis;		/* their displacements from the frame pointer */
+static long fp_n, fp_sz;	/* number of frame accesses */
+
+/* access [esp + off] with off adjusted in i_wrap() */
+static void op_fp(long off)
+{
+	if (fp_n == fp_sz) {
+		fp_sz = MAX(128, fp_sz * 2);
+		fp_pos = mextend(fp_pos, fp_n, fp_sz, sizeof(*fp_pos));
+		fp_dis = mextend(fp_dis, fp_n, fp_sz, sizeof(*fp_dis));
+	}
+	fp_pos[fp_n] = opos();
+	fp_dis[fp_n] = off;
+	fp_n++;
+	oi(off, 4);
+}
+
 /* op_*(): r=reg, m=mem, i=imm, s=sym */
 static void op_rm(int op, int src, int base, int off, int bt)
 {
 	int dis = off == (char) off ? 1 : 4;
 	int mod = dis == 4 ? 2 : 1;
+	if (FP_SLOT && base == REG_FP) {
+		op_x(op, src, R_RSP, bt);
+		oi(MODRM(2, src & 0x07, R_RSP), 1);
+		oi(0x24, 1);
+		op_fp(off);
+		return;
+	}
 	if (!off && (base & 7) != R_RBP)
 		mod = 0;
 	op_x(op, src, base, bt);
@@ -105,6 +145,17 @@ static void op_rm(int op, int src, int base, int off, int bt)
 		oi(off, dis);
 }
 
+/* memory operand [base + (idx << s)] */
+static void op_rx(int op, int src, int base, int idx, int s, int bt)
+{
+	int mod = (base & 7) == R_RBP;
+	op_x(op, src, base, bt);
+	oi(MODRM(mod, src & 0x07, 4), 1);
+	oi((s << 6) | ((idx & 0x07) << 3) | (base & 0x07), 1);
+	if (mod)
+		oi(0, 1);
+}
+
 static void op_rr(int op, int src, int dst, int bt)
 {
 	op_x(op, src, dst, bt);
@@ -151,6 +202,13 @@ static void i_add(int op, int rd, int r1, int r2)
 	op_rr(rx[op & 0x0f], rd, r2, LONGSZ);
 }
 
+static void i_add_mem(int op, int rd, int base, long off)
+{
+	/* opcode for O_ADD, O_SUB, O_AND, O_OR, O_XOR */
+	static int rx[] = {0003, 0053, 0043, 0013, 0063};
+	op_rm(rx[op & 0x0f], rd, base, off, LONGSZ);
+}
+
 static void i_add_imm(int op, int rd, int rn, long n)
 {
 	/* opcode for O_ADD, O_SUB, O_AND, O_OR, O_XOR */
@@ -189,6 +247,40 @@ static void i_div(int op, int rd, int r1, int r2)
 	op_rr(I_MUL, bt & T_MSIGN ? 7 : 6, r2, LONGSZ);
 }
 
+static void i_mulh(int op, int rd, int r1, int r2)
+{
+	op_rr(I_MUL, O_T(op) & T_MSIGN ? 5 : 4, r2, LONGSZ);
+}
+
+/* rep movs or stos of ecx bytes: words first and then the rest */
+static void i_blk(int stos)
+{
+	os("\x89\xca", 2);		/* mov edx, ecx */
+	os("\xc1\xe9\x02", 3);		/* shr ecx, 2 */
+	if (stos)
+		os("\xfc\xf3\xab", 3);	/* cld; rep stosd */
+	else
+		os("\xfc\xf3\xa5", 3);	/* cld; rep movsd */
+	os("\x89\xd1", 2);		/* mov ecx, edx */
+	os("\x83\xe1\x03", 3);		/* and ecx, 3 */
+	if (stos)
+		os("\xf3\xaa", 2);		/* rep stosb */
+	else
+		os("\xf3\xa4", 2);		/* rep movsb */
+}
+
+static void i_memcpy(void)
+{
+	i_blk(0);
+}
+
+static void i_memset(void)
+{
+	os("\x0f\xb6\xc0", 3);		/* movzx eax, al */
+	os("\x69\xc0\x01\x01\x01\x01", 6);	/* imul eax, eax, 0x01010101 */
+	i_blk(1);
+}
+
 static void i_tst(int rn, int rm)
 {
 	op_rr(I_TST, rn, rm, LONGSZ);
@@ -199,6 +291,11 @@ static void i_cmp(int rn, int rm)
 	op_rr(I_CMP, rn, rm, LONGSZ);
 }
 
+static void i_cmp_mem(int rn, int base, long off)
+{
+	op_rm(I_CMP, rn, base, off, LONGSZ);
+}
+
 static void i_cmp_imm(int rn, long n)
 {
 	unsigned char s[4] = {0x83, 0xf8 | rn, n & 0xff};
@@ -348,7 +445,17 @@ static long jmp_n, jmp_sz;	/* jump count */
 static long *jmp_off;		/* jump offsets */
 static long *jmp_dst;		/* jump destinations */
 static long *jmp_op;		/* jump opcode */
-static long jmp_ret;		/* the position of the last return jmp */
+static long jmp_ret = -1;	/* the position of the last return jmp */
+static long lab_last;		/* the last label of the current function */
+
+static long *tc_sym;		/* tail call symbols (-1 for REG_TAIL) */
+static long *tc_off;		/* tail call symbol offsets */
+static long *tc_jmp;		/* tail call jumps in jmp_off[] */
+static long tc_n, tc_sz;	/* tail call count */
+
+static long gd_op;		/* the jump of the entry guard (i_guard()) */
+static long gd_r1, gd_r2;	/* the operands of the entry guard */
+static long gd_rop, gd_ret;	/* the value returned by the entry guard */
 
 static void lab_add(long id)
 {
@@ -377,6 +484,23 @@ static void jmp_add(long op, long off, long dst)
 void i_label(long id)
 {
 	lab_add(id + 1);
+	lab_last = id + 1;
+}
+
+/* jump to the exit of a tail call, generated in i_wrap() */
+static void i_tailcall(long sym, long off)
+{
+	if (tc_n == tc_sz) {
+		tc_sz = MAX(16, tc_sz * 2);
+		tc_sym = mextend(tc_sym, tc_n, tc_sz, sizeof(*tc_sym));
+		tc_off = mextend(tc_off, tc_n, tc_sz, sizeof(*tc_off));
+		tc_jmp = mextend(tc_jmp, tc_n, tc_sz, sizeof(*tc_jmp));
+	}
+	tc_sym[tc_n] = sym;
+	tc_off[tc_n] = off;
+	tc_jmp[tc_n] = jmp_n;
+	tc_n++;
+	jmp_add(O_JMP, i_jmp(O_JMP, 4), 0);
 }
 
 static void i_rel(long sym, long flg, long off)
@@ -443,11 +567,91 @@ static void regs_load(long sregs, long dis)
 			i_pop(i);
 }
 
-void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs_pos)
+/* the number of bytes removed before off by i_shortfp() */
+static long fp_cut(long off)
+{
+	long lo = 0, hi = fp_n;
+	while (lo < hi) {
+		long mid = (lo + hi) / 2;
+		if (fp_pos[mid] < off)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo * 3;
+}
+
+/* use 8-bit displacements for frame accesses, if possible */
+static void i_shortfp(void)
+{
+	long c_len = mem_len(&cs);
+	char *c = mem_get(&cs);
+	long off = 0;
+	long n = 0;
+	long i;
+	for (i = 0; i < fp_n; i++) {
+		long pos = fp_pos[i];
+		if (fp_dis[i] != (char) fp_dis[i])
+			continue;
+		mem_put(&cs, c + off, pos - 2 - off);
+		oi((c[pos - 2] & 0x3f) | (1 << 6), 1);	/* mod 1 */
+		oi(0x24, 1);
+		oi(fp_dis[i], 1);
+		off = pos + 4;
+		fp_pos[n++] = pos;
+	}
+	mem_put(&cs, c + off, c_len - off);
+	free(c);
+	fp_n = n;
+	for (i = 0; i < rel_n; i++)
+		rel_off[i] -= fp_cut(rel_off[i]);
+	for (i = 0; i < jmp_n; i++)
+		jmp_off[i] -= fp_cut(jmp_off[i]);
+	for (i = 0; i < lab_sz; i++)
+		lab_loc[i] -= fp_cut(lab_loc[i]);
+	fp_n = 0;
+}
+
+/* release the frame; lsub is the space below the saved registers */
+static void i_leave(int initfp, long lsub)
+{
+	if (initfp && !FP_SLOT)
+		os("\xc9", 1);			/* leave */
+	if (FP_SLOT)
+		i_subsp(-lsub);
+}
+
+long i_guard(long op, long r1, long r2, long rop, long ret)
+{
+	gd_op = op;
+	gd_r1 = r1;
+	gd_r2 = r2;
+	gd_rop = rop;
+	gd_ret = ret;
+	return 0;
+}
+
+/* return before the prologue, if the entry guard holds */
+static void i_guardret(void)
+{
+	long pos;
+	i_jcmp(gd_op, gd_r1, gd_r2);
+	pos = i_jmp(gd_op ^ 1, 1);
+	if (gd_rop & O_NUM)
+		i_num(REG_RET, gd_ret);
+	else if (gd_ret != REG_RET)
+		i_mov(REG_RET, gd_ret);
+	os("\xc3", 1);			/* ret */
+	oi_at(pos, opos() - pos - 1, 1);
+	gd_op = 0;
+}
+
+void i_wrap(int argc, int aregs, long sargs, long spsub, int initfp, long sregs, long sregs_pos)
 {
 	long body_n;
 	void *body;
 	long diff;		/* prologue length */
+	long lsub = 0;		/* the space for locals */
 	int i;
 	/* removing the last jmp to the epilogue */
 	if (jmp_ret + i_jlen(O_JMP, 4) + 4 == opos()) {
@@ -458,24 +662,39 @@ void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs
 	body_n = mem_len(&cs);
 	body = mem_get(&cs);
 	/* generating function prologue */
-	if (initfp) {
+	for (i = 0; i < aregs; i++)	/* the entry of stack arguments */
+		op_rm(I_MOVR, argregs[i], R_RSP, (i + 1) * ULNG, ULNG);
+	if (gd_op)
+		i_guardret();
+	for (i = 0; i < aregs; i++)	/* saving arguments in their slots */
+		if ((1 << argregs[i]) & sargs)
+			op_rm(I_MOV, argregs[i], R_RSP, (i + 1) * ULNG, ULNG);
+	if (initfp && !FP_SLOT) {
 		os("\x55", 1);			/* push rbp */
 		os("\x89\xe5", 2);		/* mov rbp, rsp */
 	}
 	if (spsub) {
 		spsub = ALIGN(spsub, 8);
-		i_subsp(sregs ? -sregs_pos - regs_count(sregs) * ULNG : spsub);
+		lsub = sregs ? -sregs_pos - regs_count(sregs) * ULNG : spsub;
 	}
+	if (initfp)
+		lsub += FP_SLOT;
+	i_subsp(lsub);
 	if (sregs)		/* saving registers */
 		regs_save(sregs, spsub + sregs_pos);
 	diff = mem_len(&cs);
 	mem_put(&cs, body, body_n);
 	free(body);
+	/* frame accesses: esp is spsub bytes below the frame pointer */
+	for (i = 0; i < fp_n; i++) {
+		fp_pos[i] += diff;
+		fp_dis[i] += spsub;
+		oi_at(fp_pos[i], fp_dis[i], 4);
+	}
 	/* generating function epilogue */
 	if (sregs)		/* restoring saved registers */
 		regs_load(sregs, spsub + sregs_pos);
-	if (initfp)
-		os("\xc9", 1);			/* leave */
+	i_leave(initfp, lsub);
 	os("\xc3", 1);				/* ret */
 	/* adjusting code offsets */
 	for (i = 0; i < rel_n; i++)
@@ -484,6 +703,24 @@ void i_wrap(int argc, long sargs, long spsub, int initfp, long sregs, long sregs
 		jmp_off[i] += diff;
 	for (i = 0; i < lab_sz; i++)
 		lab_loc[i] += diff;
+	/* tail call exits: releasing the frame and jumping to the callee */
+	for (i = 0; i < tc_n; i++) {
+		jmp_dst[tc_jmp[i]] = lab_last + 1 + i;
+		lab_add(lab_last + 1 + i);
+		if (sregs)
+			regs_load(sregs, spsub + sregs_pos);
+		i_leave(initfp, lsub);
+		if (tc_sym[i] >= 0) {
+			os("\xe9", 1);		/* jmp $x */
+			i_rel(tc_sym[i], OUT_CS | OUT_RLREL, opos());
+			oi(-4 + tc_off[i], 4);
+		} else {
+			op_rr(I_CALL, 4, REG_TAIL, LONGSZ);	/* jmp *ecx */
+		}
+	}
+	tc_n = 0;
+	jmp_ret = -1;
+	i_shortfp();
 }
 
 /* introduce shorter jumps, if possible */
@@ -551,6 +788,11 @@ void i_done(void)
 	free(jmp_dst);
 	free(jmp_op);
 	free(lab_loc);
+	free(tc_sym);
+	free(tc_off);
+	free(tc_jmp);
+	free(fp_pos);
+	free(fp_dis);
 }
 
 long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
@@ -562,6 +804,9 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 	*r2 = 0;
 	*r3 = 0;
 	*tmp = 0;
+	/* memory operands: only for additions and comparisons */
+	if (oc & O_IND && !(oc & (O_ADD | O_CMP)))
+		return 1;
 	if (oc & O_MOV) {
 		*rd = R_TMPS;
 		if (oc & (O_NUM | O_SYM))
@@ -588,7 +833,7 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 	if (oc & O_MUL) {
 		if (oc & O_NUM)
 			return 1;
-		*rd = oc == O_MOD ? (1 << R_RDX) : (1 << R_RAX);
+		*rd = oc == O_MOD || oc == O_MULH ? (1 << R_RDX) : (1 << R_RAX);
 		*r1 = (1 << R_RAX);
 		*r2 = R_TMPS & ~*rd & ~*r1;
 		if (oc == O_DIV)
@@ -613,14 +858,16 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 		*r1 = 1 << R_RDI;
 		*r2 = 1 << R_RAX;
 		*r3 = 1 << R_RCX;
-		*tmp = (1 << R_RDI) | (1 << R_RCX);
+		*tmp = (1 << R_RDI) | (1 << R_RAX) | (1 << R_RCX) |
+			(1 << R_RDX);
 		return 0;
 	}
 	if (oc == O_MCPY) {
 		*r1 = 1 << R_RDI;
 		*r2 = 1 << R_RSI;
 		*r3 = 1 << R_RCX;
-		*tmp = (1 << R_RDI) | (1 << R_RSI) | (1 << R_RCX);
+		*tmp = (1 << R_RDI) | (1 << R_RSI) | (1 << R_RCX) |
+			(1 << R_RDX);
 		return 0;
 	}
 	if (oc == O_RET) {
@@ -630,6 +877,8 @@ long i_reg(long op, long *rd, long *r1, long *r2, long *r3, long *tmp)
 	if (oc & O_CALL) {
 		*rd = (1 << REG_RET);
 		*r1 = oc & O_SYM ? 0 : R_TMPS;
+		if (oc & O_RET && !(oc & O_SYM))
+			*r1 = 1 << REG_TAIL;
 		*tmp = R_TMPS & ~R_PERM;
 		return 0;
 	}
@@ -675,6 +924,8 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 				i_add_imm(op, r1, r1, r2);
 			else
 				i_add_anyimm(rd, r1, r2);
+		} else if (oc & O_IND) {
+			i_add_mem(op, r1, r2, r3);
 		} else {
 			i_add(op, r1, r1, r2);
 		}
@@ -692,11 +943,15 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 			i_div(op, R_RAX, r1, r2);
 		if (oc == O_MOD)
 			i_div(op, R_RDX, r1, r2);
+		if (oc == O_MULH)
+			i_mulh(op, R_RDX, r1, r2);
 		return 0;
 	}
 	if (oc & O_CMP) {
 		if (oc & O_NUM)
 			i_cmp_imm(r1, r2);
+		else if (oc & O_IND)
+			i_cmp_mem(r1, r2, r3);
 		else
 			i_cmp(r1, r2);
 		i_set(op, rd);
@@ -711,6 +966,15 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 			i_lnot(r1);
 		return 0;
 	}
+	if (oc & O_CALL && oc & O_RET) {
+		long i;
+		for (i = 0; i < r3; i++) {	/* moving stack arguments */
+			op_rm(I_MOVR, R_RDX, R_RSP, i * ULNG, ULNG);
+			op_rm(I_MOV, R_RDX, REG_FP, -I_ARG0 + i * ULNG, ULNG);
+		}
+		i_tailcall(oc & O_SYM ? r1 : -1, r2);
+		return 0;
+	}
 	if (oc == O_CALL) {
 		op_rr(I_CALL, 2, r1, LONGSZ);
 		return 0;
@@ -718,7 +982,7 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 	if (oc == (O_CALL | O_SYM)) {
 		os("\xe8", 1);		/* call $x */
 		i_rel(r1, OUT_CS | OUT_RLREL, opos());
-		oi(-4, 4);
+		oi(-4 + r2, 4);
 		return 0;
 	}
 	if (oc == (O_MOV | O_SYM)) {
@@ -730,11 +994,11 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 		return 0;
 	}
 	if (oc == O_MSET) {
-		os("\xfc\xf3\xaa", 3);		/* cld; rep stosb */
+		i_memset();
 		return 0;
 	}
 	if (oc == O_MCPY) {
-		os("\xfc\xf3\xa4", 3);		/* cld; rep movs */
+		i_memcpy();
 		return 0;
 	}
 	if (oc == O_RET) {
@@ -750,6 +1014,14 @@ long i_ins(long op, long rd, long r1, long r2, long r3)
 		op_rm(I_MOV, r1, r2, r3, bt);
 		return 0;
 	}
+	if ((oc & ~0x0f) == O_LD) {
+		op_rx(movrx_op(bt, I_MOVR), rd, r1, r2, oc & 0x0f, movrx_bt(bt));
+		return 0;
+	}
+	if ((oc & ~0x0f) == O_ST) {
+		op_rx(I_MOV, r1, r2, r3, oc & 0x0f, bt);
+		return 0;
+	}
 	if (oc == O_MOV) {
 		i_cast(rd, r1, bt);
 		return 0;
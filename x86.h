@@ -3,14 +3,30 @@
 #define I_ARCH		"__i386__"
 
 #define N_REGS		8	/* number of registers */
-#define N_TMPS		6	/* number of tmp registers */
+#ifdef X86_REGPARM		/* passing arguments in registers */
+#define N_ARGS		3	/* number of arg registers */
+#define R_ARGS		0x0007	/* mask of arg registers */
+#define I_REGENT	4	/* the register entry follows a load of each argument */
+#else
 #define N_ARGS		0	/* number of arg registers */
-#define R_TMPS		0x00cf	/* mask of tmp registers */
 #define R_ARGS		0x0000	/* mask of arg registers */
+#define I_REGENT	0	/* no register entry */
+#endif
+#ifdef X86_OMITFP		/* addressing the frame relative to esp */
+#define N_TMPS		7	/* number of tmp registers */
+#define R_TMPS		0x00ef	/* mask of tmp registers */
+#define R_PERM		0x00e8	/* mask of callee-saved registers */
+#define REG_FP		8	/* frame pointer; esp with adjusted offsets */
+#else
+#define N_TMPS		6	/* number of tmp registers */
+#define R_TMPS		0x00cf	/* mask of tmp registers */
 #define R_PERM		0x00c8	/* mask of callee-saved registers */
-
 #define REG_FP		5	/* frame pointer register */
+#endif
 #define REG_SP		4	/* stack pointer register */
 
 #define I_ARG0		(-8)	/* offset of the first argument from FP */
 #define I_LOC0		0	/* offset of the first local from FP */
+
+#define I_MEMMAX	32	/* the longest unrolled block copy or fill */
+#define I_MEMWORD	4	/* the widest access in unrolled blocks */